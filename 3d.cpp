@@ -9,6 +9,7 @@
 #include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_STATIC
 #define STBI_ONLY_PNG
 #include "stb_image.h"
 
@@ -208,29 +209,30 @@ Vec4 operator/(const Vec4& v, float s)
 // 2x2 matrix
 //
 //===================================================================================================================================================
-union Mat2 {
+struct Mat2
+{
     Mat2()
-        : X()
-        , Y()
+        : m()
     {
     }
 
-    struct
-    {
-        Vec2 X, Y;
-    };
-
+    // Columns, with X() and Y() naming them
     Vec2 m[2];
 
+    Vec2& X() { return m[0]; }
+    const Vec2& X() const { return m[0]; }
+    Vec2& Y() { return m[1]; }
+    const Vec2& Y() const { return m[1]; }
+
     Vec2& operator[](int ord) { return m[ord]; }
     const Vec2& operator[](int ord) const { return m[ord]; }
 
-    Vec2 row(int ord) const { return Vec2(X[ord], Y[ord]); }
+    Vec2 row(int ord) const { return Vec2(m[0][ord], m[1][ord]); }
 };
 
 float det(const Mat2& m)
 {
-    return m.X.x * m.Y.y - m.Y.x * m.X.y;
+    return m.X().x * m.Y().y - m.Y().x * m.X().y;
 }
 
 //===================================================================================================================================================
@@ -238,25 +240,27 @@ float det(const Mat2& m)
 // 3x3 matrix
 //
 //===================================================================================================================================================
-union Mat3 {
+struct Mat3
+{
     Mat3()
-        : X()
-        , Y()
-        , Z()
+        : m()
     {
     }
 
-    struct
-    {
-        Vec3 X, Y, Z;
-    };
-
+    // Columns, with X(), Y() and Z() naming them
     Vec3 m[3];
 
+    Vec3& X() { return m[0]; }
+    const Vec3& X() const { return m[0]; }
+    Vec3& Y() { return m[1]; }
+    const Vec3& Y() const { return m[1]; }
+    Vec3& Z() { return m[2]; }
+    const Vec3& Z() const { return m[2]; }
+
     Vec3& operator[](int ord) { return m[ord]; }
     const Vec3& operator[](int ord) const { return m[ord]; }
 
-    Vec3 row(int ord) const { return Vec3(X[ord], Y[ord], Z[ord]); }
+    Vec3 row(int ord) const { return Vec3(m[0][ord], m[1][ord], m[2][ord]); }
 };
 
 // The 2x2 submatrix formed by removing column i and row j from m
@@ -308,26 +312,29 @@ float det(const Mat3& m)
 // 4x4 matrix
 //
 //===================================================================================================================================================
-union Mat4 {
+struct Mat4
+{
     Mat4()
-        : X()
-        , Y()
-        , Z()
-        , P()
+        : m()
     {
     }
 
-    struct
-    {
-        Vec4 X, Y, Z, P;
-    };
-
+    // Columns, with X(), Y() and Z() naming the axes and P() the translation
     Vec4 m[4];
 
+    Vec4& X() { return m[0]; }
+    const Vec4& X() const { return m[0]; }
+    Vec4& Y() { return m[1]; }
+    const Vec4& Y() const { return m[1]; }
+    Vec4& Z() { return m[2]; }
+    const Vec4& Z() const { return m[2]; }
+    Vec4& P() { return m[3]; }
+    const Vec4& P() const { return m[3]; }
+
     Vec4& operator[](int ord) { return m[ord]; }
     const Vec4& operator[](int ord) const { return m[ord]; }
 
-    Vec4 row(int ord) const { return Vec4(X[ord], Y[ord], Z[ord], P[ord]); }
+    Vec4 row(int ord) const { return Vec4(m[0][ord], m[1][ord], m[2][ord], m[3][ord]); }
 
     static Mat4 identity()
     {
@@ -428,7 +435,7 @@ union Mat4 {
     static Mat4 translate(const Vec3& t)
     {
         Mat4 m = identity();
-        m.P = Vec4(t, 1.0f);
+        m.P() = Vec4(t, 1.0f);
         return m;
     }
 };
@@ -844,7 +851,7 @@ private:
             }
         }
 
-        return std::move(mesh);
+        return mesh;
     }
 
     typedef std::map<std::string, Mesh> Collection;
@@ -859,67 +866,70 @@ struct MeshRef
     bool visible;
 };
 
+//===================================================================================================================================================
+//
+// Pipeline statistics
+//
+//===================================================================================================================================================
+
+// Build with PIPELINE_STATS=0 to compile the counters out of the renderer entirely
+#ifndef PIPELINE_STATS
+#define PIPELINE_STATS 1
+#endif
+
+#if PIPELINE_STATS
+#define PIPELINE_STATS_ONLY(...) __VA_ARGS__
+#else
+#define PIPELINE_STATS_ONLY(...)
+#endif
+
+// What the renderer did in one call to draw_scene, like a GPU pipeline statistics query
+struct PipelineStats
+{
+    uint64_t triangles_submitted;  // triangles passed to draw_triangle
+    uint64_t triangles_culled;     // back-facing or zero area triangles rejected by classify
+    uint64_t triangles_rasterized; // triangles fill_triangle scanned, i.e. not culled, not wireframe and at least partly on screen
+    uint64_t pixels_covered;       // pixels inside a rasterized triangle, each of which is depth tested
+    uint64_t depth_passed;
+    uint64_t depth_failed;
+    uint64_t pixels_shaded;        // pixels lit, textured and written
+    uint64_t pixels_overdrawn;     // shaded pixels that a triangle had already written earlier in the frame
+};
+
 //===================================================================================================================================================
 //
 // Application
 //
 //===================================================================================================================================================
-class TestVgfw : public Vgfw
+class RendererVgfw : public BasicVgfw<VgfwXrgb8888>
 {
 public:
-    uint8_t pack_color(float r, float g, float b)
+    int to_channel(float c)
     {
-        int red_bits = (r == 1.0f) ? 7 : static_cast<int>(r * 8);
-        int green_bits = (g == 1.0f) ? 7 : static_cast<int>(g * 8);
-        int blue_bits = (b == 1.0f) ? 3 : static_cast<int>(b * 4);
-        return (red_bits << 5) | (green_bits << 2) | blue_bits;
+        int value = static_cast<int>(c * 255.0f + 0.5f);
+        return value < 0 ? 0 : (value > 255 ? 255 : value);
     }
 
-    uint8_t pack_color(const Vec3& color) { return pack_color(color.x, color.y, color.z); }
+    Pixel pack_color(float r, float g, float b) { return VgfwXrgb8888::from_rgb(to_channel(r), to_channel(g), to_channel(b)); }
 
-    Vec3 unpack_color(uint8_t c)
-    {
-        int red_bits = (c >> 5) & 7;
-        int green_bits = (c >> 2) & 7;
-        int blue_bits = c & 3;
-        return Vec3(red_bits / 7.0f, green_bits / 7.0f, blue_bits / 3.0f);
-    }
+    Pixel pack_color(const Vec3& color) { return pack_color(color.x, color.y, color.z); }
+
+    // 50/50 blend of two xrgb pixels, dropping each channel's low bit so the sums can't carry into the next channel
+    static Pixel blend(Pixel a, Pixel b) { return ((a & 0xfefefe) >> 1) + ((b & 0xfefefe) >> 1); }
 
     void bind_texture(Texture* tex) { texture = tex; }
 
     bool on_create() override
     {
-        // 8-bit truecolor palette
-        uint8_t r3g3b2[768];
-
-        for (int i = 0; i < 256; ++i)
-        {
-            int red_bits = (i >> 5) & 7;
-            int green_bits = (i >> 2) & 7;
-            int blue_bits = i & 0x3;
-
-            r3g3b2[(i * 3) + 0] = (red_bits * 255) / 7;
-            r3g3b2[(i * 3) + 1] = (green_bits * 255) / 7;
-            r3g3b2[(i * 3) + 2] = (blue_bits * 255) / 3;
-        }
-
-        set_palette(r3g3b2);
-
         // Create depth buffer
-        depth_buffer = std::make_unique<float[]>(screen_width * screen_height);
+        depth_buffer.allocate(screen_width, screen_height);
+        PIPELINE_STATS_ONLY(write_frames.allocate(screen_width, screen_height);)
 
         // Initialize matrices
         proj = Mat4::projection(90.0f, screen_width / (float)screen_height, 0.1f, 10.0f);
 
-        viewport_transform.X.x = screen_width * 0.5f;
-        viewport_transform.Y.y = -screen_height * 0.5f;
-        viewport_transform.Z.z = 0.5f;
-        viewport_transform.P.x = screen_width * 0.5f;
-        viewport_transform.P.y = screen_height * 0.5f;
-        viewport_transform.P.z = 0.5f;
-
         camera = Mat4::identity();
-        camera.P.z = 5.0f;
+        camera.P().z = 5.0f;
 
         // Create 3D scene
         MeshRef dragon;
@@ -962,6 +972,26 @@ public:
             filter_textures = !filter_textures;
         }
 
+        if (m_keys[VK_F3].pressed)
+        {
+            batch_lines = !batch_lines;
+        }
+
+        if (m_keys[VK_F4].pressed)
+        {
+            show_overlay(!overlay_visible());
+        }
+
+        if (m_keys[VK_F5].pressed)
+        {
+            translucent = !translucent;
+        }
+
+        if (m_keys[VK_F6].pressed)
+        {
+            set_dynamic_resolution(dynamic_resolution() ? 0.0f : 1.0f / 60.0f);
+        }
+
         if (m_keys[L' '].pressed)
         {
             anim = !anim;
@@ -986,8 +1016,8 @@ public:
         }
 
         scene[0].transform = Mat4::rotate_y(time * 60.0f * 1.5f) * Mat4::rotate_z(time * 30.0f * 1.5f) * Mat4::rotate_x(-time * 45.0f * 1.5f);
-        scene[0].transform.P.x = 1.5f * sinf(time);
-        scene[0].transform.P.z = 1.5f * cosf(time);
+        scene[0].transform.P().x = 1.5f * sinf(time);
+        scene[0].transform.P().z = 1.5f * cosf(time);
 
         scene[1].transform = inverse(scene[0].transform);
 
@@ -1003,14 +1033,31 @@ public:
         return true;
     }
 
+    // Counts for the most recent draw_scene(), all zero when built without PIPELINE_STATS
+    const PipelineStats& pipeline_stats() const { return stats; }
+
     void draw_scene()
     {
-        clear_screen(pack_color(0.5f, 0.5f, 0.5f));
+        VGFW_PROFILE_ZONE("draw_scene");
+        stats = PipelineStats();
 
-        for (int i = 0; i < screen_width * screen_height; ++i)
-        {
-            depth_buffer[i] = 1.0f;
-        }
+        // A new stamp marks every pixel unwritten without touching write_frames, which only needs clearing when the stamp wraps
+        PIPELINE_STATS_ONLY(
+            if (++write_frame == 0)
+            {
+                write_frames.fill(0);
+                write_frame = 1;
+            })
+
+        // Map to the current render size, which changes from frame to frame with dynamic resolution
+        viewport_transform.X().x = screen_width * 0.5f;
+        viewport_transform.Y().y = -screen_height * 0.5f;
+        viewport_transform.Z().z = 0.5f;
+        viewport_transform.P().x = screen_width * 0.5f;
+        viewport_transform.P().y = screen_height * 0.5f;
+        viewport_transform.P().z = 0.5f;
+
+        clear_screen_and_depth(pack_color(0.5f, 0.5f, 0.5f), depth_buffer, 1.0f);
 
         for (const MeshRef& mesh_ref : scene)
         {
@@ -1031,10 +1078,39 @@ public:
         }
 
         bind_texture(nullptr);
+
+        if (wireframe)
+        {
+            if (batch_lines)
+            {
+                auto start = std::chrono::steady_clock::now();
+                draw_lines(wireframe_lines.data(), wireframe_lines.size());
+                line_time += std::chrono::steady_clock::now() - start;
+                wireframe_lines.clear();
+            }
+
+            set_overlay_counter(batch_lines ? "lines us (batched)" : "lines us (single)",
+                                std::chrono::duration<double, std::micro>(line_time).count());
+            line_time = std::chrono::steady_clock::duration::zero();
+        }
+
+        PIPELINE_STATS_ONLY(
+            if (overlay_visible())
+            {
+                set_overlay_counter("triangles", static_cast<double>(stats.triangles_submitted));
+                set_overlay_counter("culled", static_cast<double>(stats.triangles_culled));
+                set_overlay_counter("rasterized", static_cast<double>(stats.triangles_rasterized));
+                set_overlay_counter("depth pass", static_cast<double>(stats.depth_passed));
+                set_overlay_counter("depth fail", static_cast<double>(stats.depth_failed));
+                set_overlay_counter("overdraw", static_cast<double>(stats.pixels_overdrawn));
+            })
     }
 
     void draw_triangle(const Mat4& mvp, const Mat4& model, const Vertex& v0, const Vertex& v1, const Vertex& v2)
     {
+        VGFW_PROFILE_ZONE("draw_triangle");
+        PIPELINE_STATS_ONLY(++stats.triangles_submitted;)
+
         Vec4 clip_coords[3];
 
         clip_coords[0] = mvp * Vec4(v0.p, 1.0f);
@@ -1058,21 +1134,40 @@ public:
 
         if (classify(window_coords) < 0)
         {
-            if (wireframe)
+            if (wireframe && batch_lines)
+            {
+                Pixel color = pack_color(1.0f, 1.0f, 1.0f);
+
+                for (int i = 0; i < 3; ++i)
+                {
+                    const Vec4& a = window_coords[i];
+                    const Vec4& b = window_coords[(i + 1) % 3];
+                    wireframe_lines.push_back({ static_cast<int>(a.x), static_cast<int>(a.y), static_cast<int>(b.x), static_cast<int>(b.y), color });
+                }
+            }
+            else if (wireframe)
             {
+                auto start = std::chrono::steady_clock::now();
                 draw_line(window_coords[0].x, window_coords[0].y, window_coords[1].x, window_coords[1].y, pack_color(1.0f, 1.0f, 1.0f));
                 draw_line(window_coords[1].x, window_coords[1].y, window_coords[2].x, window_coords[2].y, pack_color(1.0f, 1.0f, 1.0f));
                 draw_line(window_coords[2].x, window_coords[2].y, window_coords[0].x, window_coords[0].y, pack_color(1.0f, 1.0f, 1.0f));
+                line_time += std::chrono::steady_clock::now() - start;
             }
             else
             {
                 fill_triangle(window_coords, model, v0, v1, v2);
             }
         }
+        else
+        {
+            PIPELINE_STATS_ONLY(++stats.triangles_culled;)
+        }
     }
 
     void fill_triangle(Vec4* screen_coords, const Mat4& model, const Vertex& v0, const Vertex& v1, const Vertex& v2)
     {
+        VGFW_PROFILE_ZONE("fill_triangle");
+
         Edge e01(screen_coords[0].xy(), screen_coords[1].xy());
         Edge e12(screen_coords[1].xy(), screen_coords[2].xy());
         Edge e20(screen_coords[2].xy(), screen_coords[0].xy());
@@ -1103,9 +1198,22 @@ public:
         Vec2 uvoz[3] = { v0.uv * ooz[0], v1.uv * ooz[1], v2.uv * ooz[2] };
 
         float denom = 1.0f / triangle_area_2(screen_coords);
+        View target = lock_rect(bounds_min_x, bounds_min_y, bounds_max_x - bounds_min_x, bounds_max_y - bounds_min_y);
+
+        if (target.empty())
+        {
+            return;
+        }
+
+        // Counted locally, since stores through row could alias the members and keep them out of registers
+        PIPELINE_STATS_ONLY(uint32_t covered = 0, passed = 0, shaded = 0, overdrawn = 0; uint32_t stamp = write_frame;)
 
         for (int y = bounds_min_y; y < bounds_max_y; ++y)
         {
+            Pixel* row = target.row(y - bounds_min_y) - bounds_min_x;
+            float* depth_row = depth_buffer.row(y);
+            PIPELINE_STATS_ONLY(uint32_t* write_row = write_frames.row(y);)
+
             for (int x = bounds_min_x; x < bounds_max_x; ++x)
             {
                 Vec2 p(x, y);
@@ -1116,6 +1224,7 @@ public:
 
                 if (w01 * area_scale >= 0.0f && w12 * area_scale >= 0.0f && w20 * area_scale >= 0.0f)
                 {
+                    PIPELINE_STATS_ONLY(++covered;)
                     float w0 = w12 * denom;
                     float w1 = w20 * denom;
                     float w2 = w01 * denom;
@@ -1123,9 +1232,10 @@ public:
                     float z = 1.0f / (ooz[0] * w0 + ooz[1] * w1 + ooz[2] * w2);
                     float d = (doz[0] * w0 + doz[1] * w1 + doz[2] * w2) * z;
 
-                    if (d <= depth_buffer[x + (y * screen_width)])
+                    if (d <= depth_row[x])
                     {
-                        depth_buffer[x + (y * screen_width)] = d;
+                        PIPELINE_STATS_ONLY(++passed;)
+                        depth_row[x] = d;
                         Vec3 normal = rotate(model, (noz[0] * w0 + noz[1] * w1 + noz[2] * w2) * z);
                         float ndotl = dot(normal, Vec3(0.732f, 0.732f, 0.732f));
                         ndotl = ndotl < 0.0f ? 0.0f : (ndotl > 1.0f ? 1.0f : ndotl);
@@ -1138,14 +1248,21 @@ public:
                             texture_color = filter_textures ? texture->sample_box(uv) : texture->sample(uv);
                         }
 
-                        float alpha = 1.0f;
-                        Vec3 existing_color = unpack_color(get_pixel(x, y));
-                        Vec3 color = existing_color * (1.0f - alpha) + (texture_color * light_color) * alpha;
-                        set_pixel(x, y, pack_color(color));
+                        Pixel color = pack_color(texture_color * light_color);
+                        row[x] = translucent ? blend(color, row[x]) : color;
+                        PIPELINE_STATS_ONLY(++shaded; overdrawn += write_row[x] == stamp; write_row[x] = stamp;)
                     }
                 }
             }
         }
+
+        PIPELINE_STATS_ONLY(
+            ++stats.triangles_rasterized;
+            stats.pixels_covered += covered;
+            stats.depth_passed += passed;
+            stats.depth_failed += covered - passed;
+            stats.pixels_shaded += shaded;
+            stats.pixels_overdrawn += overdrawn;)
     }
 
     TextureCatalog texture_catalog;
@@ -1158,14 +1275,49 @@ public:
     float time = 0.0f;
     bool anim = true;
     bool wireframe = false;
+    bool batch_lines = true;
+    bool translucent = false;
+    std::vector<Line> wireframe_lines;
+    std::chrono::steady_clock::duration line_time = std::chrono::steady_clock::duration::zero();
     bool filter_textures = true;
-    std::unique_ptr<float[]> depth_buffer;
+    VgfwSurface<float> depth_buffer;
+    PipelineStats stats = PipelineStats();
+#if PIPELINE_STATS
+    // Stamp of the last frame to write each pixel, for telling overdraw apart from first writes whatever depth they land at
+    VgfwSurface<uint32_t> write_frames;
+    uint32_t write_frame = 0;
+#endif
     Texture* texture = nullptr;
 };
 
+#ifdef VGFW_NO_MAIN
+#include "vgfw_bench.h"
+
+// Scene for vgfw_bench: the textured scene, then with the extra cubes, translucency and finally batched wireframe on top
+bool bench_3d(VgfwBenchScene scene, VgfwFrameTimer& timer)
+{
+    scene.width = 1024;
+    scene.height = 768;
+    scene.press(150, 'R');
+    scene.press(300, VK_F5);
+    scene.press(450, VK_F1);
+
+    // Missing assets are replaced by placeholders, which would time a different scene
+    if (!std::ifstream("models/dragon/dragon_model.obj") || !std::ifstream("models/dragon/DefaultMaterial_basecolor.png"))
+    {
+        return false;
+    }
+
+    return vgfw_run_bench<RendererVgfw>(L"Vgfw 3D Renderer", scene, timer);
+}
+#else
+#if VGFW_PLATFORM_WIN32
 int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
+#else
+int main()
+#endif
 {
-    TestVgfw test_app;
+    RendererVgfw test_app;
 
     if (!test_app.initialize(L"Vgfw 3D Renderer", 1024, 768, 1))
     {
@@ -1176,3 +1328,4 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 
     return EXIT_SUCCESS;
 }
+#endif
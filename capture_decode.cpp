@@ -0,0 +1,100 @@
+#include "vgfw.h"
+
+// Decodes a capture written by Vgfw::start_capture(). Prints a line per frame with a hash of its pixels and palette, and if an
+// output prefix is given also writes each frame as <prefix>NNNNNN.ppm.
+
+static uint64_t hash_frame(const uint8_t* pixels, size_t count, const uint32_t* palette)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        hash = (hash ^ pixels[i]) * 0x100000001b3ull;
+    }
+
+    for (int i = 0; i < 256; ++i)
+    {
+        hash = (hash ^ palette[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static bool write_ppm(const char* path, const VgfwCaptureReader& reader)
+{
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", reader.width(), reader.height());
+    std::vector<uint8_t> row(reader.width() * 3);
+
+    for (int y = 0; y < reader.height(); ++y)
+    {
+        const uint8_t* src = reader.pixels() + static_cast<size_t>(y) * reader.width();
+
+        for (int x = 0; x < reader.width(); ++x)
+        {
+            uint32_t color = reader.palette()[src[x]];
+            row[x * 3 + 0] = static_cast<uint8_t>(color >> 16);
+            row[x * 3 + 1] = static_cast<uint8_t>(color >> 8);
+            row[x * 3 + 2] = static_cast<uint8_t>(color);
+        }
+
+        fwrite(row.data(), 1, row.size(), file);
+    }
+
+    return fclose(file) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <capture> [output prefix]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    VgfwCaptureReader reader;
+
+    if (!reader.open(argv[1]))
+    {
+        fprintf(stderr, "%s: not a vgfw capture\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    size_t pixel_count = static_cast<size_t>(reader.width()) * reader.height();
+    int frames = 0;
+
+    while (reader.read_frame())
+    {
+        printf("%llu %016llx\n", static_cast<unsigned long long>(reader.frame_number()),
+            static_cast<unsigned long long>(hash_frame(reader.pixels(), pixel_count, reader.palette())));
+
+        if (argc > 2)
+        {
+            std::string path = std::string(argv[2]) + std::to_string(1000000 + frames).substr(1) + ".ppm";
+
+            if (!write_ppm(path.c_str(), reader))
+            {
+                fprintf(stderr, "%s: write failed\n", path.c_str());
+                return EXIT_FAILURE;
+            }
+        }
+
+        ++frames;
+    }
+
+    if (reader.failed())
+    {
+        fprintf(stderr, "%s: damaged record after %d frames\n", argv[1], frames);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "%d frames of %dx%d\n", frames, reader.width(), reader.height());
+    return EXIT_SUCCESS;
+}
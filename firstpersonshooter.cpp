@@ -1,12 +1,14 @@
 #include "vgfw.h"
 
+#include <float.h>
 #include <math.h>
 
 #define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_STATIC
 #define STBI_ONLY_PNG
 #include "stb_image.h"
 
-class TestVgfw : public Vgfw
+class ShooterVgfw : public Vgfw
 {
     struct Vec2
     {
@@ -69,16 +71,26 @@ class TestVgfw : public Vgfw
 
     uint8_t* wall_texture = nullptr;
 
-    uint8_t attenuate(uint8_t color, float intensity)
+    // The palette is 8 rows of 32 colors, each row a darker copy of the one above, and the first color of every row is left
+    // unshaded. shade_rows[level] moves a color down to the row for light level 0 (darkest) to 7 (full brightness).
+    uint8_t shade_rows[8][256];
+
+    void build_shade_rows()
     {
-        if ((color & 31) == 0)
+        for (int level = 0; level < 8; ++level)
         {
-            return color;
+            for (int c = 0; c < 256; ++c)
+            {
+                shade_rows[level][c] = (c & 31) == 0 ? static_cast<uint8_t>(c) : static_cast<uint8_t>(c + (7 - level) * 32);
+            }
         }
+    }
 
+    // Shade table for a light intensity between 0 and 1
+    const uint8_t* attenuation(float intensity)
+    {
         intensity = (intensity > 1.0f) ? 1.0f : ((intensity < 0.0f) ? 0.0f : intensity);
-        int idx = 7 - (int)(intensity * 7.0f + 0.5f);
-        return color + idx * 32;
+        return shade_rows[(int)(intensity * 7.0f + 0.5f)];
     }
 
     float degrees_to_radians(float d)
@@ -87,28 +99,7 @@ class TestVgfw : public Vgfw
         return d * radians_per_degree;
     }
 
-    uint8_t map_color_to_palette(uint8_t r, uint8_t g, uint8_t b, uint8_t* palette)
-    {
-        for (int p = 0; p < 32; ++p)
-        {
-            if (palette[p * 3] == r && palette[(p * 3) + 1] == g && palette[(p * 3) + 2] == b)
-            {
-                return p;
-            }
-        }
-
-        for (int p = 32; p < 256; p += 32)
-        {
-            if (palette[p * 3] == r && palette[(p * 3) + 1] == g && palette[(p * 3) + 2] == b)
-            {
-                return p;
-            }
-        }
-
-        return 0;
-    }
-
-    uint8_t* load_texture(const char* path, uint8_t* palette)
+    uint8_t* load_texture(const char* path, const VgfwInverseColormap& colormap)
     {
         int x, y, comp;
         stbi_uc* file_data = stbi_load(path, &x, &y, &comp, 3);
@@ -120,6 +111,7 @@ class TestVgfw : public Vgfw
 
         if (x != 64 || y != 64)
         {
+            stbi_image_free(file_data);
             return nullptr;
         }
 
@@ -130,9 +122,10 @@ class TestVgfw : public Vgfw
             uint8_t r = file_data[p * 3];
             uint8_t g = file_data[(p * 3) + 1];
             uint8_t b = file_data[(p * 3) + 2];
-            texture[p] = map_color_to_palette(r, g, b, palette);
+            texture[p] = colormap.nearest(r, g, b);
         }
 
+        stbi_image_free(file_data);
         return texture;
     }
 
@@ -158,7 +151,7 @@ class TestVgfw : public Vgfw
 
         // Load palette
         int x, y, comp;
-        stbi_uc* palette_data = stbi_load("textures\\palette.png", &x, &y, &comp, 3);
+        stbi_uc* palette_data = stbi_load("textures/palette.png", &x, &y, &comp, 3);
 
         if (!palette_data)
         {
@@ -166,8 +159,9 @@ class TestVgfw : public Vgfw
         }
 
         set_palette(palette_data);
+        build_shade_rows();
 
-        wall_texture = load_texture("textures\\bricks.png", palette_data);
+        wall_texture = load_texture("textures/bricks.png", inverse_colormap());
 
         stbi_image_free(palette_data);
 
@@ -176,6 +170,9 @@ class TestVgfw : public Vgfw
             return false;
         }
 
+        // Fade in from black
+        flash_palette(0x000000, 1.0f);
+
         return true;
     }
 
@@ -250,181 +247,194 @@ class TestVgfw : public Vgfw
         player_x += move_x;
         player_y += move_y;
 
-        // Draw
-        for (int col = 0; col < screen_width; ++col)
-        {
-            // Get world space ray direction for column
-            float rx = cos_facing * screen_rays[col].x - sin_facing * screen_rays[col].y;
-            float ry = sin_facing * screen_rays[col].x + cos_facing * screen_rays[col].y;
-
-            // Cast ray through the map and find the nearest intersection with a solid tile
-            float distance = FLT_MAX;
-            int column = 0;
+        // Draw. Every column is written from top to bottom, so nothing behind it needs keeping, and columns are independent so
+        // they are split across the job system.
+        VGFW_PROFILE_ZONE("raycast_columns");
+        VgfwView screen = lock_screen(true);
 
-            if (rx > 0.0f)
+        parallel_for(0, screen_width, 16, [&](int first, int last) {
+            for (int col = first; col < last; ++col)
             {
-                float dydx = ry / rx;
-                int tx = floorf(player_x + 1.0f);
+                VgfwColumn pixels = screen.column(col, 0, screen_height);
 
-                for ( ; tx < world_size_x; ++tx)
-                {
-                    float y = player_y + dydx * (tx - player_x);
-                    int ty = floorf(y);
+                // Get world space ray direction for column
+                float rx = cos_facing * screen_rays[col].x - sin_facing * screen_rays[col].y;
+                float ry = sin_facing * screen_rays[col].x + cos_facing * screen_rays[col].y;
 
-                    if (ty < 0 || ty >= world_size_y)
-                    {
-                        break;
-                    }
+                // Cast ray through the map and find the nearest intersection with a solid tile
+                float distance = FLT_MAX;
+                int column = 0;
 
-                    if (world_map[ty][tx] != '.')
+                if (rx > 0.0f)
+                {
+                    float dydx = ry / rx;
+                    int tx = floorf(player_x + 1.0f);
+
+                    for ( ; tx < world_size_x; ++tx)
                     {
-                        float hit_d = (tx - player_x) * (tx - player_x) + (y - player_y) * (y - player_y);
+                        float y = player_y + dydx * (tx - player_x);
+                        int ty = floorf(y);
 
-                        if (hit_d < distance)
+                        if (ty < 0 || ty >= world_size_y)
                         {
-                            distance = hit_d;
-                            column = (int)(y * 64.0f + 0.5f) & 63;
+                            break;
                         }
 
-                        break;
-                    }
-                }
-            }
-            else if (rx < 0.0f)
-            {
-                float dydx = ry / rx;
-                int tx = floorf(player_x - 1.0f);
+                        if (world_map[ty][tx] != '.')
+                        {
+                            float hit_d = (tx - player_x) * (tx - player_x) + (y - player_y) * (y - player_y);
 
-                for ( ; tx >= 0; --tx)
-                {
-                    float y = player_y + dydx * (tx + 1.0f - player_x);
-                    int ty = floorf(y);
+                            if (hit_d < distance)
+                            {
+                                distance = hit_d;
+                                column = (int)(y * 64.0f + 0.5f) & 63;
+                            }
 
-                    if (ty < 0 || ty >= world_size_y)
-                    {
-                        break;
+                            break;
+                        }
                     }
+                }
+                else if (rx < 0.0f)
+                {
+                    float dydx = ry / rx;
+                    int tx = floorf(player_x - 1.0f);
 
-                    if (world_map[ty][tx] != '.')
+                    for ( ; tx >= 0; --tx)
                     {
-                        float hit_d = (tx + 1.0f - player_x) * (tx + 1.0f - player_x) + (y - player_y) * (y - player_y);
+                        float y = player_y + dydx * (tx + 1.0f - player_x);
+                        int ty = floorf(y);
 
-                        if (hit_d < distance)
+                        if (ty < 0 || ty >= world_size_y)
                         {
-                            distance = hit_d;
-                            column = (int)(y * 64.0f + 0.5f) & 63;
+                            break;
                         }
 
-                        break;
+                        if (world_map[ty][tx] != '.')
+                        {
+                            float hit_d = (tx + 1.0f - player_x) * (tx + 1.0f - player_x) + (y - player_y) * (y - player_y);
+
+                            if (hit_d < distance)
+                            {
+                                distance = hit_d;
+                                column = (int)(y * 64.0f + 0.5f) & 63;
+                            }
+
+                            break;
+                        }
                     }
                 }
-            }
-
-            if (ry > 0.0f)
-            {
-                float dxdy = rx / ry;
-                int ty = floorf(player_y + 1.0f);
 
-                for ( ; ty < world_size_y; ++ty)
+                if (ry > 0.0f)
                 {
-                    float x = player_x + dxdy * (ty - player_y);
-                    int tx = floorf(x);
-
-                    if (tx < 0 || tx >= world_size_x)
-                    {
-                        break;
-                    }
+                    float dxdy = rx / ry;
+                    int ty = floorf(player_y + 1.0f);
 
-                    if (world_map[ty][tx] != '.')
+                    for ( ; ty < world_size_y; ++ty)
                     {
-                        float hit_d = (x - player_x) * (x - player_x) + (ty - player_y) * (ty - player_y);
+                        float x = player_x + dxdy * (ty - player_y);
+                        int tx = floorf(x);
 
-                        if (hit_d < distance)
+                        if (tx < 0 || tx >= world_size_x)
                         {
-                            distance = hit_d;
-                            column = (int)(x * 64.0f + 0.5f) & 63;
+                            break;
                         }
 
-                        break;
-                    }
-                }
-            }
-            else if (ry < 0.0f)
-            {
-                float dxdy = rx / ry;
-                int ty = floorf(player_y - 1.0f);
+                        if (world_map[ty][tx] != '.')
+                        {
+                            float hit_d = (x - player_x) * (x - player_x) + (ty - player_y) * (ty - player_y);
 
-                for ( ; ty >= 0; --ty)
-                {
-                    float x = player_x + dxdy * (ty + 1.0f - player_y);
-                    int tx = floorf(x);
+                            if (hit_d < distance)
+                            {
+                                distance = hit_d;
+                                column = (int)(x * 64.0f + 0.5f) & 63;
+                            }
 
-                    if (tx < 0 || tx >= world_size_x)
-                    {
-                        break;
+                            break;
+                        }
                     }
+                }
+                else if (ry < 0.0f)
+                {
+                    float dxdy = rx / ry;
+                    int ty = floorf(player_y - 1.0f);
 
-                    if (world_map[ty][tx] != '.')
+                    for ( ; ty >= 0; --ty)
                     {
-                        float hit_d = (x - player_x) * (x - player_x) + (ty + 1.0f - player_y) * (ty + 1.0f - player_y);
+                        float x = player_x + dxdy * (ty + 1.0f - player_y);
+                        int tx = floorf(x);
 
-                        if (hit_d < distance)
+                        if (tx < 0 || tx >= world_size_x)
                         {
-                            distance = hit_d;
-                            column = (int)(x * 64.0f + 0.5f) & 63;
+                            break;
                         }
 
-                        break;
+                        if (world_map[ty][tx] != '.')
+                        {
+                            float hit_d = (x - player_x) * (x - player_x) + (ty + 1.0f - player_y) * (ty + 1.0f - player_y);
+
+                            if (hit_d < distance)
+                            {
+                                distance = hit_d;
+                                column = (int)(x * 64.0f + 0.5f) & 63;
+                            }
+
+                            break;
+                        }
                     }
                 }
-            }
 
-            if (distance == FLT_MAX)
-            {
-                // Ray hit nothing
-                for (int y = 0; y < screen_height / 2; ++y)
+                if (distance == FLT_MAX)
                 {
-                    distance = (screen_height * wall_height * screen_distance) / (screen_height - 2.0f * y);
-                    float attenuation_factor = 6.0f / distance;
-                    attenuation_factor = attenuation_factor < 0.0f ? 0.0f : (attenuation_factor > 1.0f ? 1.0f : attenuation_factor);
-                    set_pixel(col, y, attenuate(sky_color, attenuation_factor));
-                    set_pixel(col, screen_height - y - 1, attenuate(floor_color, attenuation_factor));
+                    // Ray hit nothing
+                    for (int y = 0; y < screen_height / 2; ++y)
+                    {
+                        distance = (screen_height * wall_height * screen_distance) / (screen_height - 2.0f * y);
+                        float attenuation_factor = 6.0f / distance;
+                        attenuation_factor = attenuation_factor < 0.0f ? 0.0f : (attenuation_factor > 1.0f ? 1.0f : attenuation_factor);
+                        const uint8_t* shade = attenuation(attenuation_factor);
+                        pixels[y] = shade[sky_color];
+                        pixels[screen_height - y - 1] = shade[floor_color];
+                    }
                 }
-            }
-            else
-            {
-                // Project hit distance to view depth
-                distance = sqrtf(distance) * screen_rays[col].x;
-
-                float attenuation_factor = 6.0f / distance;
-                attenuation_factor = attenuation_factor < 0.0f ? 0.0f : (attenuation_factor > 1.0f ? 1.0f : attenuation_factor);
-
-                // Scale wall column height by distance
-                float column_height = wall_height * (screen_distance / distance);
-                int ceiling = (int)((1.0f - column_height) * 0.5f * screen_height);
-                int floor = screen_height - ceiling;
-
-                for (int y = 0; y < screen_height / 2 && y < ceiling; ++y)
+                else
                 {
-                    distance = (screen_height * wall_height * screen_distance) / (screen_height - 2.0f * y);
+                    // Project hit distance to view depth
+                    distance = sqrtf(distance) * screen_rays[col].x;
+
                     float attenuation_factor = 6.0f / distance;
                     attenuation_factor = attenuation_factor < 0.0f ? 0.0f : (attenuation_factor > 1.0f ? 1.0f : attenuation_factor);
-                    set_pixel(col, y, attenuate(sky_color, attenuation_factor));
-                    set_pixel(col, screen_height - y - 1, attenuate(floor_color, attenuation_factor));
-                }
 
-                float v = 0.0f;
-                float dvdy = 64.0f / (floor - ceiling);
+                    // Scale wall column height by distance
+                    float column_height = wall_height * (screen_distance / distance);
+                    int ceiling = (int)((1.0f - column_height) * 0.5f * screen_height);
+                    int floor = screen_height - ceiling;
 
-                for (int y = ceiling; y < screen_height && y < floor; ++y)
-                {
-                    int iv = (int)(v + 0.5f) & 63;
-                    uint8_t texel = wall_texture[iv * 64 + column];
-                    set_pixel(col, y, attenuate(texel, attenuation_factor));
-                    v += dvdy;
+                    for (int y = 0; y < screen_height / 2 && y < ceiling; ++y)
+                    {
+                        distance = (screen_height * wall_height * screen_distance) / (screen_height - 2.0f * y);
+                        float attenuation_factor = 6.0f / distance;
+                        attenuation_factor = attenuation_factor < 0.0f ? 0.0f : (attenuation_factor > 1.0f ? 1.0f : attenuation_factor);
+                        const uint8_t* shade = attenuation(attenuation_factor);
+                        pixels[y] = shade[sky_color];
+                        pixels[screen_height - y - 1] = shade[floor_color];
+                    }
+
+                    // Start the texture part way down when the wall is clipped by the top of the screen
+                    VgfwColumn wall = screen.column(col, ceiling, floor - ceiling);
+                    float dvdy = 64.0f / (floor - ceiling);
+                    float v = wall.skipped * dvdy;
+                    const uint8_t* shade = attenuation(attenuation_factor);
+
+                    for (int y = 0; y < wall.count; ++y)
+                    {
+                        int iv = (int)(v + 0.5f) & 63;
+                        uint8_t texel = wall_texture[iv * 64 + column];
+                        wall[y] = shade[texel];
+                        v += dvdy;
+                    }
                 }
             }
-        }
+        });
 
         return true;
     }
@@ -456,9 +466,29 @@ class TestVgfw : public Vgfw
     }
 };
 
+#ifdef VGFW_NO_MAIN
+#include "vgfw_bench.h"
+
+// Scene for vgfw_bench: a walk around the map, turning and strafing along the way
+bool bench_fps(VgfwBenchScene scene, VgfwFrameTimer& timer)
+{
+    scene.width = 1024;
+    scene.height = 768;
+    scene.hold(0, 120, 'W');
+    scene.hold(120, 210, 'A');
+    scene.hold(210, 360, 'W');
+    scene.hold(360, 450, 'E');
+    scene.hold(450, 600, 'D');
+    return vgfw_run_bench<ShooterVgfw>(L"First Person Shooter", scene, timer);
+}
+#else
+#if VGFW_PLATFORM_WIN32
 int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
+#else
+int main()
+#endif
 {
-    TestVgfw test_app;
+    ShooterVgfw test_app;
 
     if (!test_app.initialize(L"First Person Shooter", 1024, 768, 1))
     {
@@ -469,3 +499,4 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 
     return EXIT_SUCCESS;
 }
+#endif
@@ -1,5 +1,7 @@
 #include "vgfw.h"
 
+#include <math.h>
+
 class TestVgfw : public Vgfw
 {
 public:
@@ -42,6 +44,23 @@ public:
         blue_vel[0] = 0.3;
         blue_vel[1] = 0.14;
 
+        // A shaded ball on a transparent background (index 0). Setting the top red bit keeps its pixels off the key.
+        uint8_t ball[16 * 16];
+
+        for (int y = 0; y < 16; ++y)
+        {
+            for (int x = 0; x < 16; ++x)
+            {
+                float dx = (x - 7.5f) / 8.0f;
+                float dy = (y - 7.5f) / 8.0f;
+                float d = dx * dx + dy * dy;
+                float shade = 1.0f - sqrtf((dx + 0.4f) * (dx + 0.4f) + (dy + 0.4f) * (dy + 0.4f)) * 0.6f;
+                ball[x + y * 16] = d < 1.0f ? (make_color(shade, shade, 0.2f) | 0x80) : 0;
+            }
+        }
+
+        ball_sprite.from_indexed(ball, 16, 16, 16, 0);
+
         return true;
     }
 
@@ -91,54 +110,96 @@ public:
             greyscale = !greyscale;
         }
 
+        if (m_keys[L'S'].pressed)
+        {
+            sprites = !sprites;
+        }
+
+        time += delta;
+
+        // Lock on this thread, then fill the rows in parallel since each pixel only depends on its position
+        VgfwView screen = lock_screen(true);
+
         if (!greyscale)
         {
-            for (int x = 0; x < screen_width; ++x)
-            {
-                for (int y = 0; y < screen_height; ++y)
+            parallel_for(0, screen_height, 8, [&](int first, int last) {
+                for (int y = first; y < last; ++y)
                 {
-                    float fx = x / static_cast<float>(screen_width);
-                    float fy = y / static_cast<float>(screen_height);
+                    uint8_t* row = screen.row(y);
 
-                    float dr = sqrtf((red_spot[0] - fx) * (red_spot[0] - fx) + (red_spot[1] - fy) * (red_spot[1] - fy));
-                    dr = dr < 1.0f ? dr : 1.0f;
-                    float r = 1.0f - dr;
+                    for (int x = 0; x < screen_width; ++x)
+                    {
+                        float fx = x / static_cast<float>(screen_width);
+                        float fy = y / static_cast<float>(screen_height);
 
-                    float dg = sqrtf((green_spot[0] - fx) * (green_spot[0] - fx) + (green_spot[1] - fy) * (green_spot[1] - fy));
-                    dg = dg < 1.0f ? dg : 1.0f;
-                    float g = 1.0f - dg;
+                        float dr = sqrtf((red_spot[0] - fx) * (red_spot[0] - fx) + (red_spot[1] - fy) * (red_spot[1] - fy));
+                        dr = dr < 1.0f ? dr : 1.0f;
+                        float r = 1.0f - dr;
 
-                    float db = sqrtf((blue_spot[0] - fx) * (blue_spot[0] - fx) + (blue_spot[1] - fy) * (blue_spot[1] - fy));
-                    db = db < 1.0f ? db : 1.0f;
-                    float b = 1.0f - db;
+                        float dg = sqrtf((green_spot[0] - fx) * (green_spot[0] - fx) + (green_spot[1] - fy) * (green_spot[1] - fy));
+                        dg = dg < 1.0f ? dg : 1.0f;
+                        float g = 1.0f - dg;
 
-                    set_pixel(x, y, make_color(r * r, g * g, b * b));
+                        float db = sqrtf((blue_spot[0] - fx) * (blue_spot[0] - fx) + (blue_spot[1] - fy) * (blue_spot[1] - fy));
+                        db = db < 1.0f ? db : 1.0f;
+                        float b = 1.0f - db;
+
+                        row[x] = make_color(r * r, g * g, b * b);
+                    }
                 }
-            }
+            });
         }
         else
         {
-            for (int x = 0; x < screen_width; ++x)
-            {
-                for (int y = 0; y < screen_height; ++y)
+            parallel_for(0, screen_height, 8, [&](int first, int last) {
+                for (int y = first; y < last; ++y)
                 {
-                    float fx = x / static_cast<float>(screen_width);
-                    float fy = y / static_cast<float>(screen_height);
+                    uint8_t* row = screen.row(y);
+
+                    for (int x = 0; x < screen_width; ++x)
+                    {
+                        float fx = x / static_cast<float>(screen_width);
+                        float fy = y / static_cast<float>(screen_height);
 
-                    float dr = sqrtf((0.5f - fx) * (0.5f - fx) + (0.5f - fy) * (0.5f - fy));
-                    dr = dr < 1.0f ? dr : 1.0f;
-                    float r = (1.0f - dr) * (1.0f - dr);
+                        float dr = sqrtf((0.5f - fx) * (0.5f - fx) + (0.5f - fy) * (0.5f - fy));
+                        dr = dr < 1.0f ? dr : 1.0f;
+                        float r = (1.0f - dr) * (1.0f - dr);
 
-                    set_pixel(x, y, make_color(r, r, r));
+                        row[x] = make_color(r, r, r);
+                    }
+                }
+            });
+        }
+
+        if (sprites)
+        {
+            // Lissajous swarm, every other ball mirrored and every fourth one stretched
+            for (int i = 0; i < 2000; ++i)
+            {
+                float phase = i * 0.01f + time;
+                int x = static_cast<int>((sinf(phase * 1.3f) * 0.55f + 0.5f) * screen_width) - 8;
+                int y = static_cast<int>((cosf(phase * 0.7f + i) * 0.55f + 0.5f) * screen_height) - 8;
+
+                if (i % 4 == 0)
+                {
+                    draw_sprite_scaled(ball_sprite, x, y, 24, 12, (i & 1) != 0);
+                }
+                else
+                {
+                    draw_sprite(ball_sprite, x, y, (i & 1) != 0);
                 }
             }
         }
+
         return true;
     }
 
     void on_destroy() override {}
 
     bool greyscale = false;
+    bool sprites = false;
+    float time = 0.0f;
+    VgfwSprite ball_sprite;
     float red_spot[2];
     float green_spot[2];
     float blue_spot[2];
@@ -147,7 +208,24 @@ public:
     float blue_vel[2];
 };
 
+#ifdef VGFW_NO_MAIN
+#include "vgfw_bench.h"
+
+// Scene for vgfw_bench: the plasma alone, then with the sprite swarm, then greyscale with the swarm
+bool bench_test(VgfwBenchScene scene, VgfwFrameTimer& timer)
+{
+    scene.width = 256;
+    scene.height = 256;
+    scene.press(200, 'S');
+    scene.press(400, ' ');
+    return vgfw_run_bench<TestVgfw>(L"Vgfw Test App", scene, timer);
+}
+#else
+#if VGFW_PLATFORM_WIN32
 int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
+#else
+int main()
+#endif
 {
     TestVgfw test_app;
 
@@ -160,3 +238,4 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 
     return EXIT_SUCCESS;
 }
+#endif
@@ -1,350 +1,4910 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+// Platform selection. Windows builds get a window unless VGFW_HEADLESS is defined, everything else runs headless.
+#if defined(_WIN32) && !defined(VGFW_HEADLESS)
+#define VGFW_PLATFORM_WIN32 1
+// Keep Windows.h from defining min and max macros, which break std::min, std::max and any member with those names
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
 #include <Windows.h>
+#else
+#define VGFW_PLATFORM_HEADLESS 1
+#endif
 
-class Vgfw
+// SIMD support for the presentation kernels
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VGFW_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define VGFW_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if VGFW_PLATFORM_HEADLESS && !defined(VK_F1)
+// Virtual key codes with the same values as Win32 so apps can index m_keys the same way on every platform
+enum
+{
+    VK_LBUTTON = 0x01,
+    VK_RBUTTON = 0x02,
+    VK_MBUTTON = 0x04,
+    VK_BACK = 0x08,
+    VK_TAB = 0x09,
+    VK_RETURN = 0x0d,
+    VK_SHIFT = 0x10,
+    VK_CONTROL = 0x11,
+    VK_ESCAPE = 0x1b,
+    VK_SPACE = 0x20,
+    VK_LEFT = 0x25,
+    VK_UP = 0x26,
+    VK_RIGHT = 0x27,
+    VK_DOWN = 0x28,
+    VK_F1 = 0x70,
+    VK_F2 = 0x71,
+    VK_F3 = 0x72,
+    VK_F4 = 0x73,
+    VK_F5 = 0x74,
+    VK_F6 = 0x75,
+    VK_F7 = 0x76,
+    VK_F8 = 0x77,
+    VK_F9 = 0x78,
+    VK_F10 = 0x79,
+    VK_F11 = 0x7a,
+    VK_F12 = 0x7b,
+};
+#endif
+
+struct VgfwRect
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+//===================================================================================================================================================
+//
+// Threading
+//
+//===================================================================================================================================================
+
+// Lock-free single producer, single consumer ring. push() may only be called from one thread and pop() from one other thread.
+template <typename T>
+class VgfwSpscRing
 {
 public:
-    int screen_width;
-    int screen_height;
-    int window_width;
-    int window_height;
+    // Empty the ring and size it for capacity items. Not thread safe.
+    void reset(int capacity)
+    {
+        m_items.assign(capacity + 1, T());
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    bool push(const T& item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % m_items.size();
+
+        if (next == m_head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        m_items[tail] = item;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        item = m_items[head];
+        m_head.store((head + 1) % m_items.size(), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire); }
+
+private:
+    std::vector<T> m_items;
+    alignas(64) std::atomic<size_t> m_head{ 0 };
+    alignas(64) std::atomic<size_t> m_tail{ 0 };
+};
+
+// Lets a thread sleep until another thread has changed some state, such as pushing to a VgfwSpscRing. The state itself is not
+// guarded by the mutex, it is only taken to avoid missing a wakeup between the waiter testing its predicate and going to sleep.
+class VgfwSignal
+{
+public:
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+
+        m_cv.notify_all();
+    }
+
+    template <typename Predicate>
+    void wait(Predicate predicate)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, predicate);
+    }
+
+    template <typename Rep, typename Period, typename Predicate>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout, Predicate predicate)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_cv.wait_for(lock, timeout, predicate);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+//===================================================================================================================================================
+//
+// Input
+//
+//===================================================================================================================================================
+
+// A key or mouse button changing state. key is a virtual key code, timestamp is steady clock nanoseconds.
+struct VgfwInputEvent
+{
+    uint64_t timestamp;
+    uint8_t key;
+    bool down;
+};
+
+// Input events waiting to be handed to the app. The platform layer pushes as events arrive, and anything else, such as a
+// headless test driver, can push too.
+class VgfwInputQueue
+{
+public:
+    void push(int key, bool down)
+    {
+        VgfwInputEvent event;
+        event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        event.key = static_cast<uint8_t>(key);
+        event.down = down;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events.push_back(event);
+    }
+
+    // Move every queued event into events, replacing its contents
+    void drain(std::vector<VgfwInputEvent>& events)
+    {
+        events.clear();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events.swap(events);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<VgfwInputEvent> m_events;
+};
+
+// Binary log of the delta and input events of each frame, for replaying a session exactly. The file is an 8 byte header
+// followed by one record per frame: the delta as a 32-bit float, the event count as a varint (7 bits a byte, low bits first, high
+// bit set on all but the last byte), then two bytes per event (key, down).
+class VgfwInputLog
+{
+public:
+    ~VgfwInputLog() { close(); }
+
+    bool open_write(const char* path)
+    {
+        close();
+        m_file = fopen(path, "wb");
+
+        if (!m_file)
+        {
+            return false;
+        }
+
+        m_writing = true;
+        return fwrite(magic(), 1, 8, m_file) == 8;
+    }
+
+    bool open_read(const char* path)
+    {
+        close();
+        m_file = fopen(path, "rb");
+
+        if (!m_file)
+        {
+            return false;
+        }
+
+        char header[8];
+
+        if (fread(header, 1, 8, m_file) != 8 || memcmp(header, magic(), 8) != 0)
+        {
+            close();
+            return false;
+        }
+
+        m_writing = false;
+        return true;
+    }
+
+    void close()
+    {
+        if (m_file)
+        {
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+    bool is_open() const { return m_file != nullptr; }
+    bool is_writing() const { return m_file && m_writing; }
+    bool is_reading() const { return m_file && !m_writing; }
+
+    void write_frame(float delta, const std::vector<VgfwInputEvent>& events)
+    {
+        fwrite(&delta, sizeof(delta), 1, m_file);
+        write_count(events.size());
+
+        for (const VgfwInputEvent& input : events)
+        {
+            uint8_t event[2] = { input.key, static_cast<uint8_t>(input.down) };
+            fwrite(event, 1, 2, m_file);
+        }
+    }
+
+    // Returns false at the end of the log
+    bool read_frame(float& delta, std::vector<VgfwInputEvent>& events)
+    {
+        uint64_t count;
+
+        if (fread(&delta, sizeof(delta), 1, m_file) != 1 || !read_count(count))
+        {
+            return false;
+        }
+
+        // Grown an event at a time, so a damaged count runs into the end of the file rather than a huge allocation
+        events.clear();
+        uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint8_t data[2];
+
+            if (fread(data, 1, 2, m_file) != 2)
+            {
+                return false;
+            }
+
+            VgfwInputEvent event;
+            event.timestamp = now;
+            event.key = data[0];
+            event.down = data[1] != 0;
+            events.push_back(event);
+        }
+
+        return true;
+    }
+
+private:
+    static const char* magic() { return "VGFWINP2"; }
+
+    void write_count(uint64_t count)
+    {
+        while (count >= 0x80)
+        {
+            fputc(static_cast<int>((count & 0x7f) | 0x80), m_file);
+            count >>= 7;
+        }
+
+        fputc(static_cast<int>(count), m_file);
+    }
+
+    bool read_count(uint64_t& count)
+    {
+        count = 0;
+
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int byte = fgetc(m_file);
+
+            if (byte == EOF)
+            {
+                return false;
+            }
+
+            count |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+            if (!(byte & 0x80))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    FILE* m_file = nullptr;
+    bool m_writing = false;
+};
+
+//===================================================================================================================================================
+//
+// Profiling
+//
+//===================================================================================================================================================
+
+// Records named zones (begin and end times in steady clock nanoseconds) into a buffer per thread, and writes them out as a
+// Chrome trace that chrome://tracing, Perfetto or Speedscope can open. Each thread only ever appends to its own buffer, so
+// recording takes no locks. While disabled a zone costs one relaxed load. Zone names must outlive the trace, e.g. literals.
+class VgfwProfiler
+{
+public:
+    struct Event
+    {
+        const char* name;
+        int64_t begin;
+        int64_t end;
+    };
+
+    static VgfwProfiler& instance()
+    {
+        static VgfwProfiler profiler;
+        return profiler;
+    }
+
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Discard any recorded zones and start recording, keeping up to events_per_thread zones on each thread
+    void enable(size_t events_per_thread = 1 << 18)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = events_per_thread;
+        m_epoch = now();
+        m_generation.fetch_add(1, std::memory_order_release);
+        m_enabled.store(true, std::memory_order_release);
+    }
+
+    void disable() { m_enabled.store(false, std::memory_order_release); }
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // Name the calling thread in traces
+    void set_thread_name(const char* name)
+    {
+        thread_state().name = name;
+
+        if (thread_state().buffer)
+        {
+            thread_state().buffer->name = name;
+        }
+    }
+
+    void record(const char* name, int64_t begin, int64_t end)
+    {
+        ThreadBuffer* buffer = thread_buffer();
+        size_t count = buffer->count.load(std::memory_order_relaxed);
+
+        if (count == buffer->events.size())
+        {
+            buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        buffer->events[count] = { name, begin, end };
+        buffer->count.store(count + 1, std::memory_order_release);
+    }
+
+    // Zones lost because a thread's buffer was full
+    uint64_t dropped() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t total = 0;
+
+        for (const auto& buffer : m_buffers)
+        {
+            total += buffer->generation == m_generation.load() ? buffer->dropped.load() : 0;
+        }
+
+        return total;
+    }
+
+    // Write the zones recorded since enable() as complete ("X") events. Zones still open on other threads are left out.
+    bool write_chrome_trace(const char* path) const
+    {
+        FILE* file = fopen(path, "w");
+
+        if (!file)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint32_t generation = m_generation.load();
+        bool first = true;
+
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+        for (size_t t = 0; t < m_buffers.size(); ++t)
+        {
+            const ThreadBuffer& buffer = *m_buffers[t];
+
+            if (buffer.generation != generation)
+            {
+                continue;
+            }
+
+            if (buffer.name)
+            {
+                fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",",
+                        static_cast<int>(t));
+                write_json_string(file, buffer.name);
+                fprintf(file, "\"}}");
+                first = false;
+            }
+
+            size_t count = buffer.count.load(std::memory_order_acquire);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Event& event = buffer.events[i];
+                fprintf(file, "%s\n{\"name\":\"", first ? "" : ",");
+                write_json_string(file, event.name);
+                fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", static_cast<int>(t),
+                        (event.begin - m_epoch) / 1000.0, (event.end - event.begin) / 1000.0);
+                first = false;
+            }
+        }
+
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        return true;
+    }
+
+private:
+    struct ThreadBuffer
+    {
+        std::vector<Event> events;
+        std::atomic<size_t> count{ 0 };
+        std::atomic<uint64_t> dropped{ 0 };
+        uint32_t generation = 0;
+        const char* name = nullptr;
+    };
+
+    struct ThreadState
+    {
+        ThreadBuffer* buffer = nullptr;
+        const char* name = nullptr;
+    };
+
+    VgfwProfiler() = default;
+
+    static ThreadState& thread_state()
+    {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    // The calling thread's buffer, registered on first use and emptied on the first use after each enable()
+    ThreadBuffer* thread_buffer()
+    {
+        ThreadState& state = thread_state();
+        uint32_t generation = m_generation.load(std::memory_order_acquire);
+
+        if (state.buffer && state.buffer->generation == generation)
+        {
+            return state.buffer;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!state.buffer)
+        {
+            m_buffers.emplace_back(new ThreadBuffer);
+            state.buffer = m_buffers.back().get();
+            state.buffer->name = state.name;
+        }
+
+        state.buffer->events.assign(m_capacity, Event());
+        state.buffer->count.store(0);
+        state.buffer->dropped.store(0);
+        state.buffer->generation = m_generation.load();
+        return state.buffer;
+    }
+
+    static void write_json_string(FILE* file, const char* s)
+    {
+        for (; *s; ++s)
+        {
+            if (*s == '"' || *s == '\\')
+            {
+                fputc('\\', file);
+            }
+
+            fputc(static_cast<unsigned char>(*s) < 0x20 ? ' ' : *s, file);
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+    std::atomic<bool> m_enabled{ false };
+    std::atomic<uint32_t> m_generation{ 0 };
+    size_t m_capacity = 0;
+    int64_t m_epoch = 0;
+};
+
+// Times the enclosing scope as a zone when the profiler is enabled
+class VgfwProfileZone
+{
+public:
+    explicit VgfwProfileZone(const char* name)
+        : m_name(VgfwProfiler::instance().enabled() ? name : nullptr), m_begin(m_name ? VgfwProfiler::now() : 0)
+    {
+    }
+
+    ~VgfwProfileZone()
+    {
+        if (m_name)
+        {
+            VgfwProfiler::instance().record(m_name, m_begin, VgfwProfiler::now());
+        }
+    }
+
+    VgfwProfileZone(const VgfwProfileZone&) = delete;
+    VgfwProfileZone& operator=(const VgfwProfileZone&) = delete;
+
+private:
+    const char* m_name;
+    int64_t m_begin;
+};
+
+// VGFW_PROFILE_ZONE("name") times the rest of the enclosing scope. Define VGFW_NO_PROFILER to compile zones out entirely.
+#define VGFW_PROFILE_JOIN2(a, b) a##b
+#define VGFW_PROFILE_JOIN(a, b) VGFW_PROFILE_JOIN2(a, b)
+
+#if defined(VGFW_NO_PROFILER)
+#define VGFW_PROFILE_ZONE(name)
+#else
+#define VGFW_PROFILE_ZONE(name) VgfwProfileZone VGFW_PROFILE_JOIN(vgfw_profile_zone_, __LINE__)(name)
+#endif
+
+//===================================================================================================================================================
+//
+// Jobs
+//
+//===================================================================================================================================================
+
+// Jobs added to a task group can be waited for together with VgfwJobSystem::wait()
+class VgfwTaskGroup
+{
+public:
+    bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class VgfwJobSystem;
+    std::atomic<int> m_pending{ 0 };
+};
+
+// Work-stealing thread pool. Each thread has a deque of jobs: it takes its own newest job first, and when that is empty steals
+// the oldest job of another thread. The thread that starts the pool counts as worker 0 and runs jobs while it waits, so a
+// pool with no extra threads still works, running everything in wait(). Only worker 0 and jobs themselves may add jobs.
+class VgfwJobSystem
+{
+public:
+    ~VgfwJobSystem() { stop(); }
+
+    // Start worker_count threads in addition to the calling thread
+    void start(int worker_count)
+    {
+        stop();
+        m_workers.clear();
+
+        for (int i = 0; i <= worker_count; ++i)
+        {
+            m_workers.emplace_back(new Worker);
+        }
+
+        m_stop = false;
+        current() = { this, 0 };
+
+        for (int i = 1; i <= worker_count; ++i)
+        {
+            m_workers[i]->thread = std::thread(&VgfwJobSystem::worker_thread, this, i);
+        }
+    }
+
+    void stop()
+    {
+        m_stop = true;
+        m_signal.notify();
+
+        for (auto& worker : m_workers)
+        {
+            if (worker->thread.joinable())
+            {
+                worker->thread.join();
+            }
+        }
+    }
+
+    // Threads that run jobs, including worker 0
+    int thread_count() const { return m_workers.empty() ? 1 : static_cast<int>(m_workers.size()); }
+
+    // Index of the calling thread in the pool, 0 for any thread that isn't a pool thread
+    int worker_index() const { return current().system == this ? current().index : 0; }
+
+    void run(VgfwTaskGroup& group, std::function<void()> job)
+    {
+        if (m_workers.empty())
+        {
+            job();
+            return;
+        }
+
+        Worker& worker = *m_workers[worker_index()];
+        group.m_pending.fetch_add(1, std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.jobs.push_back({ std::move(job), &group });
+        }
+
+        m_queued.fetch_add(1);
+
+        if (m_sleeping.load() > 0)
+        {
+            m_signal.notify();
+        }
+    }
+
+    // Run jobs until every job in group has finished
+    void wait(VgfwTaskGroup& group)
+    {
+        int index = worker_index();
+
+        while (!group.done())
+        {
+            if (!run_one(index))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Call fn(chunk_begin, chunk_end) over [begin, end) split into chunks of at least grain items, across all threads
+    template <typename Function>
+    void parallel_for(int begin, int end, int grain, const Function& fn)
+    {
+        int count = end - begin;
+        grain = grain < 1 ? 1 : grain;
+        int chunks = (count + grain - 1) / grain;
+        chunks = chunks < thread_count() * 4 ? chunks : thread_count() * 4;
+
+        if (chunks <= 1 || m_workers.size() <= 1)
+        {
+            if (count > 0)
+            {
+                fn(begin, end);
+            }
+
+            return;
+        }
+
+        VgfwTaskGroup group;
+
+        for (int c = 1; c < chunks; ++c)
+        {
+            int chunk_begin = begin + static_cast<int>(static_cast<int64_t>(count) * c / chunks);
+            int chunk_end = begin + static_cast<int>(static_cast<int64_t>(count) * (c + 1) / chunks);
+            run(group, [&fn, chunk_begin, chunk_end] { fn(chunk_begin, chunk_end); });
+        }
+
+        fn(begin, begin + count / chunks);
+        wait(group);
+    }
+
+    // Call fn(x0, y0, x1, y1) for each tile_width x tile_height tile of a width x height area, across all threads
+    template <typename Function>
+    void parallel_for_tiles(int width, int height, int tile_width, int tile_height, const Function& fn)
+    {
+        int tiles_x = (width + tile_width - 1) / tile_width;
+        int tiles_y = (height + tile_height - 1) / tile_height;
+
+        parallel_for(0, tiles_x * tiles_y, 1, [&](int first, int last) {
+            for (int tile = first; tile < last; ++tile)
+            {
+                int x0 = (tile % tiles_x) * tile_width;
+                int y0 = (tile / tiles_x) * tile_height;
+                fn(x0, y0, x0 + tile_width < width ? x0 + tile_width : width, y0 + tile_height < height ? y0 + tile_height : height);
+            }
+        });
+    }
+
+    // At least bytes of 64-byte aligned memory private to the calling thread. Contents are left over from earlier use, and the
+    // memory stays valid until the same thread asks for more.
+    void* scratch(size_t bytes)
+    {
+        if (m_workers.empty())
+        {
+            m_workers.emplace_back(new Worker);
+        }
+
+        std::vector<uint8_t>& memory = m_workers[worker_index()]->scratch;
+
+        if (memory.size() < bytes + 63)
+        {
+            memory.resize(bytes + 63);
+        }
+
+        return reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(memory.data()) + 63) & ~static_cast<uintptr_t>(63));
+    }
+
+private:
+    struct Job
+    {
+        std::function<void()> function;
+        VgfwTaskGroup* group;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::vector<uint8_t> scratch;
+        std::thread thread;
+    };
+
+    struct Current
+    {
+        VgfwJobSystem* system;
+        int index;
+    };
+
+    static Current& current()
+    {
+        thread_local Current state = { nullptr, 0 };
+        return state;
+    }
+
+    // Run the calling thread's newest job, or steal another thread's oldest. Returns false if there was nothing to run.
+    bool run_one(int index)
+    {
+        if (m_queued.load() == 0)
+        {
+            return false;
+        }
+
+        Job job;
+        bool found = false;
+
+        for (size_t i = 0; i < m_workers.size() && !found; ++i)
+        {
+            Worker& worker = *m_workers[(index + i) % m_workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+
+            if (!worker.jobs.empty())
+            {
+                if (i == 0)
+                {
+                    job = std::move(worker.jobs.back());
+                    worker.jobs.pop_back();
+                }
+                else
+                {
+                    job = std::move(worker.jobs.front());
+                    worker.jobs.pop_front();
+                }
+
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            return false;
+        }
+
+        m_queued.fetch_sub(1);
+        job.function();
+        job.group->m_pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    void worker_thread(int index)
+    {
+        current() = { this, index };
+        VgfwProfiler::instance().set_thread_name("worker");
+
+        while (!m_stop)
+        {
+            if (run_one(index))
+            {
+                continue;
+            }
+
+            // Announce the sleep before testing for jobs, so run() either sees a sleeper or the test sees its job
+            m_sleeping.fetch_add(1);
+            m_signal.wait([this] { return m_queued.load() > 0 || m_stop; });
+            m_sleeping.fetch_sub(1);
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<int> m_queued{ 0 };
+    std::atomic<int> m_sleeping{ 0 };
+    std::atomic<bool> m_stop{ false };
+    VgfwSignal m_signal;
+};
+
+//===================================================================================================================================================
+//
+// Frame timing
+//
+//===================================================================================================================================================
+
+// Stages of Vgfw::run that are timed separately. Frame is the time from the start of one frame to the start of the next.
+// Clear is only recorded by Vgfw::clear_screen_and_depth(), as part of Update.
+enum class VgfwStage
+{
+    Frame,
+    Messages,
+    Input,
+    Update,
+    Present,
+    Clear,
+    Count
+};
+
+// Steady clock frame timer. Each stage keeps a rolling window of its most recent samples, which percentile() and window_max() report
+// on, and a histogram of every sample since reset() with quarter octave buckets from 1us, which the session_* queries and the
+// CSV/JSON dumps report on. All times are in microseconds.
+class VgfwFrameTimer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int window_size = 1024;
+    static const int bucket_count = 96;
+
+    VgfwFrameTimer() { reset(); }
+
+    void reset()
+    {
+        memset(m_series, 0, sizeof(m_series));
+        m_frame_started = false;
+    }
+
+    // Start timing a frame. Records the length of the previous frame, if there was one.
+    void begin_frame()
+    {
+        Clock::time_point now = Clock::now();
+
+        if (m_frame_started)
+        {
+            record(VgfwStage::Frame, to_microseconds(now - m_frame_start));
+            profile(VgfwStage::Frame, m_frame_start, now);
+        }
+
+        m_frame_start = now;
+        m_stamp = now;
+        m_frame_started = true;
+    }
+
+    // Record the time since the last begin_frame() or end_stage() against stage
+    void end_stage(VgfwStage stage)
+    {
+        Clock::time_point now = Clock::now();
+        record(stage, to_microseconds(now - m_stamp));
+        profile(stage, m_stamp, now);
+        m_stamp = now;
+    }
+
+    void record(VgfwStage stage, float microseconds)
+    {
+        Series& series = m_series[static_cast<int>(stage)];
+        series.window[series.count % window_size] = microseconds;
+        series.count++;
+        series.total += microseconds;
+        series.max = microseconds > series.max ? microseconds : series.max;
+        series.buckets[bucket_index(microseconds)]++;
+    }
+
+    // Most recent sample
+    float last(VgfwStage stage) const
+    {
+        const Series& series = m_series[static_cast<int>(stage)];
+        return series.count ? series.window[(series.count - 1) % window_size] : 0.0f;
+    }
+
+    // Percentile p (0 to 1) over the rolling window
+    float percentile(VgfwStage stage, float p) const
+    {
+        const Series& series = m_series[static_cast<int>(stage)];
+        int n = series.count < window_size ? static_cast<int>(series.count) : window_size;
+
+        if (n == 0)
+        {
+            return 0.0f;
+        }
+
+        float samples[window_size];
+        memcpy(samples, series.window, n * sizeof(float));
+        int k = static_cast<int>(p * (n - 1) + 0.5f);
+        k = k < 0 ? 0 : (k >= n ? n - 1 : k);
+        std::nth_element(samples, samples + k, samples + n);
+        return samples[k];
+    }
+
+    // Largest sample in the rolling window
+    float window_max(VgfwStage stage) const
+    {
+        const Series& series = m_series[static_cast<int>(stage)];
+        int n = series.count < window_size ? static_cast<int>(series.count) : window_size;
+        return n ? *std::max_element(series.window, series.window + n) : 0.0f;
+    }
+
+    // Percentile p (0 to 1) over every sample since reset(), resolved to the upper bound of its histogram bucket
+    float session_percentile(VgfwStage stage, float p) const
+    {
+        const Series& series = m_series[static_cast<int>(stage)];
+        uint64_t target = static_cast<uint64_t>(p * series.count + 0.5);
+        uint64_t seen = 0;
+
+        for (int b = 0; b < bucket_count; ++b)
+        {
+            seen += series.buckets[b];
+
+            if (seen >= target && seen > 0)
+            {
+                float upper = bucket_upper_bound(b);
+                return upper < series.max ? upper : series.max;
+            }
+        }
+
+        return series.max;
+    }
+
+    float session_max(VgfwStage stage) const { return m_series[static_cast<int>(stage)].max; }
+
+    float session_mean(VgfwStage stage) const
+    {
+        const Series& series = m_series[static_cast<int>(stage)];
+        return series.count ? static_cast<float>(series.total / series.count) : 0.0f;
+    }
+
+    uint64_t count(VgfwStage stage) const { return m_series[static_cast<int>(stage)].count; }
+
+    static const char* stage_name(VgfwStage stage)
+    {
+        static const char* names[] = { "frame", "messages", "input", "update", "present", "clear" };
+        return names[static_cast<int>(stage)];
+    }
+
+    // Upper bound in microseconds of histogram bucket b. Bucket 0 holds everything up to 1us.
+    static float bucket_upper_bound(int b) { return powf(2.0f, b * 0.25f); }
+
+    bool write_csv(const char* path) const
+    {
+        FILE* file = fopen(path, "w");
+
+        if (!file)
+        {
+            return false;
+        }
+
+        fprintf(file, "stage,count,mean_us,p50_us,p95_us,p99_us,max_us\n");
+
+        for (int i = 0; i < static_cast<int>(VgfwStage::Count); ++i)
+        {
+            VgfwStage stage = static_cast<VgfwStage>(i);
+            fprintf(file, "%s,%llu,%.2f,%.2f,%.2f,%.2f,%.2f\n", stage_name(stage), (unsigned long long)count(stage), session_mean(stage),
+                    session_percentile(stage, 0.5f), session_percentile(stage, 0.95f), session_percentile(stage, 0.99f), session_max(stage));
+        }
+
+        fclose(file);
+        return true;
+    }
+
+    bool write_json(const char* path) const
+    {
+        FILE* file = fopen(path, "w");
+
+        if (!file)
+        {
+            return false;
+        }
+
+        fprintf(file, "{\n  \"stages\": {");
+
+        for (int i = 0; i < static_cast<int>(VgfwStage::Count); ++i)
+        {
+            VgfwStage stage = static_cast<VgfwStage>(i);
+            const Series& series = m_series[i];
+            fprintf(file, "%s\n    \"%s\": {\n", i ? "," : "", stage_name(stage));
+            fprintf(file, "      \"count\": %llu,\n      \"mean_us\": %.2f,\n", (unsigned long long)series.count, session_mean(stage));
+            fprintf(file, "      \"p50_us\": %.2f,\n      \"p95_us\": %.2f,\n      \"p99_us\": %.2f,\n      \"max_us\": %.2f,\n",
+                    session_percentile(stage, 0.5f), session_percentile(stage, 0.95f), session_percentile(stage, 0.99f), session_max(stage));
+            fprintf(file, "      \"histogram\": [");
+
+            bool first = true;
+
+            for (int b = 0; b < bucket_count; ++b)
+            {
+                if (series.buckets[b])
+                {
+                    fprintf(file, "%s[%.2f, %llu]", first ? "" : ", ", bucket_upper_bound(b), (unsigned long long)series.buckets[b]);
+                    first = false;
+                }
+            }
+
+            fprintf(file, "]\n    }");
+        }
+
+        fprintf(file, "\n  }\n}\n");
+        fclose(file);
+        return true;
+    }
+
+private:
+    struct Series
+    {
+        float window[window_size];
+        uint64_t count;
+        double total;
+        float max;
+        uint64_t buckets[bucket_count];
+    };
+
+    static float to_microseconds(Clock::duration d) { return std::chrono::duration<float, std::micro>(d).count(); }
+
+    // Stages double as profiler zones
+    static void profile(VgfwStage stage, Clock::time_point begin, Clock::time_point end)
+    {
+        VgfwProfiler& profiler = VgfwProfiler::instance();
+
+        if (profiler.enabled())
+        {
+            using std::chrono::nanoseconds;
+            profiler.record(stage_name(stage), std::chrono::duration_cast<nanoseconds>(begin.time_since_epoch()).count(),
+                            std::chrono::duration_cast<nanoseconds>(end.time_since_epoch()).count());
+        }
+    }
+
+    static int bucket_index(float microseconds)
+    {
+        if (microseconds <= 1.0f)
+        {
+            return 0;
+        }
+
+        int b = static_cast<int>(ceilf(log2f(microseconds) * 4.0f));
+        return b < bucket_count ? b : bucket_count - 1;
+    }
+
+    Series m_series[static_cast<int>(VgfwStage::Count)];
+    Clock::time_point m_frame_start;
+    Clock::time_point m_stamp;
+    bool m_frame_started;
+};
+
+// Feedback controller for dynamic resolution. Rendering cost is taken to be proportional to the number of pixels drawn, so each
+// update moves the scale (a fraction of the full screen size on each axis) by the square root of the ratio between the target
+// time and a smoothed measured time. Steps are capped, larger when shrinking than growing, and differences within a small dead
+// band are ignored, so a spike is answered quickly while the scale settles rather than hunting around the target.
+class VgfwResolutionController
+{
+public:
+    // Scale between min_scale and max_scale (0 to 1) to keep frames near target_seconds. A target of 0 holds the scale fixed at
+    // max_scale.
+    void configure(float target_seconds, float min_scale, float max_scale)
+    {
+        m_max_scale = max_scale < 0.0625f ? 0.0625f : (max_scale > 1.0f ? 1.0f : max_scale);
+        m_min_scale = min_scale < 0.0625f ? 0.0625f : (min_scale > m_max_scale ? m_max_scale : min_scale);
+        m_target = target_seconds > 0.0f ? target_seconds : 0.0f;
+        m_scale = m_max_scale;
+        m_smoothed = 0.0f;
+    }
+
+    bool enabled() const { return m_target > 0.0f; }
+    float scale() const { return m_scale; }
+    float target() const { return m_target; }
+
+    // Feed the time the last frame took at the current scale, and get the scale for the next one
+    float update(float seconds)
+    {
+        if (!enabled() || seconds <= 0.0f)
+        {
+            return m_scale;
+        }
+
+        m_smoothed = m_smoothed > 0.0f ? m_smoothed + (seconds - m_smoothed) * 0.125f : seconds;
+        float ratio = m_target / m_smoothed;
+
+        if (ratio > 0.95f && ratio < 1.05f)
+        {
+            return m_scale;
+        }
+
+        float step = sqrtf(ratio);
+        step = step < 0.9f ? 0.9f : (step > 1.02f ? 1.02f : step);
+        float scale = m_scale * step;
+        scale = scale < m_min_scale ? m_min_scale : (scale > m_max_scale ? m_max_scale : scale);
+
+        // Predict the time at the new scale, so the smoothed value doesn't keep asking for a change that has already been made
+        m_smoothed *= (scale * scale) / (m_scale * m_scale);
+        m_scale = scale;
+        return m_scale;
+    }
+
+private:
+    float m_target = 0.0f;
+    float m_min_scale = 1.0f;
+    float m_max_scale = 1.0f;
+    float m_scale = 1.0f;
+    float m_smoothed = 0.0f;
+};
+
+//===================================================================================================================================================
+//
+// Text overlay
+//
+//===================================================================================================================================================
+
+// Lines of text drawn into an 8-bit surface with a built-in 8x8 font. Glyphs are cached pre-colored, and a line is only
+// rasterized into the overlay's image when its text or the colors change, so drawing the overlay is one row copy per scanline.
+class VgfwOverlay
+{
+public:
+    static const int glyph_size = 8;
+    static const int max_columns = 48;
+    static const int image_pitch = max_columns * glyph_size;
+
+    VgfwOverlay() { build_glyph_cache(); }
+
+    void set_colors(uint8_t foreground, uint8_t background)
+    {
+        if (foreground == m_foreground && background == m_background)
+        {
+            return;
+        }
+
+        m_foreground = foreground;
+        m_background = background;
+        build_glyph_cache();
+
+        for (int i = 0; i < line_count(); ++i)
+        {
+            rasterize_line(i);
+        }
+    }
+
+    int line_count() const { return static_cast<int>(m_lines.size()); }
+
+    void set_line_count(int count)
+    {
+        if (count == line_count())
+        {
+            return;
+        }
+
+        m_lines.resize(count);
+        m_image.resize(count * glyph_size * image_pitch);
+
+        for (int i = 0; i < count; ++i)
+        {
+            rasterize_line(i);
+        }
+    }
+
+    // Set the text of line index, growing the overlay if needed. Text past max_columns is cut off.
+    void set_line(int index, const char* text)
+    {
+        if (index >= line_count())
+        {
+            set_line_count(index + 1);
+        }
+
+        std::string line(text, strnlen(text, max_columns));
+
+        if (line != m_lines[index])
+        {
+            m_lines[index].swap(line);
+            rasterize_line(index);
+        }
+    }
+
+    // Size in pixels of the box drawn, which is as wide as the longest line
+    int width() const
+    {
+        size_t columns = 0;
+
+        for (const std::string& line : m_lines)
+        {
+            columns = line.size() > columns ? line.size() : columns;
+        }
+
+        return static_cast<int>(columns) * glyph_size;
+    }
+
+    int height() const { return line_count() * glyph_size; }
+
+    // Copy the overlay into dst at (x, y), clipped to dst_width x dst_height
+    void draw(uint8_t* dst, int dst_pitch, int dst_width, int dst_height, int x, int y) const
+    {
+        int src_x, src_y, w, h;
+
+        if (!clip(dst_width, dst_height, x, y, src_x, src_y, w, h))
+        {
+            return;
+        }
+
+        for (int row = 0; row < h; ++row)
+        {
+            memcpy(dst + (y + row) * dst_pitch + x, &m_image[(src_y + row) * image_pitch + src_x], w);
+        }
+    }
+
+    // Draw into a frame of another pixel type, mapping the overlay's palette indices through colors
+    template <typename T>
+    void draw(T* dst, int dst_pitch, int dst_width, int dst_height, int x, int y, const T* colors) const
+    {
+        int src_x, src_y, w, h;
+
+        if (!clip(dst_width, dst_height, x, y, src_x, src_y, w, h))
+        {
+            return;
+        }
+
+        for (int row = 0; row < h; ++row)
+        {
+            const uint8_t* src = &m_image[(src_y + row) * image_pitch + src_x];
+            T* out = dst + (y + row) * dst_pitch + x;
+
+            for (int i = 0; i < w; ++i)
+            {
+                out[i] = colors[src[i]];
+            }
+        }
+    }
+
+private:
+    // Clip the overlay at (x, y) to dst_width x dst_height, moving (x, y) to the first visible pixel, which is (src_x, src_y) in
+    // the overlay, and leaving the visible size in w x h. Returns false if none of it is visible.
+    bool clip(int dst_width, int dst_height, int& x, int& y, int& src_x, int& src_y, int& w, int& h) const
+    {
+        w = width();
+        h = height();
+
+        // Rejecting off-screen positions first keeps the sums below from overflowing
+        if (x >= dst_width || y >= dst_height || x <= -w || y <= -h)
+        {
+            return false;
+        }
+
+        src_x = x < 0 ? -x : 0;
+        src_y = y < 0 ? -y : 0;
+        x += src_x;
+        y += src_y;
+        w -= src_x;
+        h -= src_y;
+        w = w > dst_width - x ? dst_width - x : w;
+        h = h > dst_height - y ? dst_height - y : h;
+        return w > 0 && h > 0;
+    }
+
+    // 8x8 glyphs for ASCII 32 to 127, one byte per row with the leftmost pixel in bit 0
+    static const uint8_t (*font())[glyph_size]
+    {
+        static const uint8_t glyphs[96][glyph_size] = {
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+            { 0x18, 0x3c, 0x3c, 0x18, 0x18, 0x00, 0x18, 0x00 }, // !
+            { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+            { 0x36, 0x36, 0x7f, 0x36, 0x7f, 0x36, 0x36, 0x00 }, // #
+            { 0x0c, 0x3e, 0x03, 0x1e, 0x30, 0x1f, 0x0c, 0x00 }, // $
+            { 0x00, 0x63, 0x33, 0x18, 0x0c, 0x66, 0x63, 0x00 }, // %
+            { 0x1c, 0x36, 0x1c, 0x6e, 0x3b, 0x33, 0x6e, 0x00 }, // &
+            { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+            { 0x18, 0x0c, 0x06, 0x06, 0x06, 0x0c, 0x18, 0x00 }, // (
+            { 0x06, 0x0c, 0x18, 0x18, 0x18, 0x0c, 0x06, 0x00 }, // )
+            { 0x00, 0x66, 0x3c, 0xff, 0x3c, 0x66, 0x00, 0x00 }, // *
+            { 0x00, 0x0c, 0x0c, 0x3f, 0x0c, 0x0c, 0x00, 0x00 }, // +
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x06 }, // ,
+            { 0x00, 0x00, 0x00, 0x3f, 0x00, 0x00, 0x00, 0x00 }, // -
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x00 }, // .
+            { 0x60, 0x30, 0x18, 0x0c, 0x06, 0x03, 0x01, 0x00 }, // /
+            { 0x3e, 0x63, 0x73, 0x7b, 0x6f, 0x67, 0x3e, 0x00 }, // 0
+            { 0x0c, 0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x3f, 0x00 }, // 1
+            { 0x1e, 0x33, 0x30, 0x1c, 0x06, 0x33, 0x3f, 0x00 }, // 2
+            { 0x1e, 0x33, 0x30, 0x1c, 0x30, 0x33, 0x1e, 0x00 }, // 3
+            { 0x38, 0x3c, 0x36, 0x33, 0x7f, 0x30, 0x78, 0x00 }, // 4
+            { 0x3f, 0x03, 0x1f, 0x30, 0x30, 0x33, 0x1e, 0x00 }, // 5
+            { 0x1c, 0x06, 0x03, 0x1f, 0x33, 0x33, 0x1e, 0x00 }, // 6
+            { 0x3f, 0x33, 0x30, 0x18, 0x0c, 0x0c, 0x0c, 0x00 }, // 7
+            { 0x1e, 0x33, 0x33, 0x1e, 0x33, 0x33, 0x1e, 0x00 }, // 8
+            { 0x1e, 0x33, 0x33, 0x3e, 0x30, 0x18, 0x0e, 0x00 }, // 9
+            { 0x00, 0x0c, 0x0c, 0x00, 0x00, 0x0c, 0x0c, 0x00 }, // :
+            { 0x00, 0x0c, 0x0c, 0x00, 0x00, 0x0c, 0x0c, 0x06 }, // ;
+            { 0x18, 0x0c, 0x06, 0x03, 0x06, 0x0c, 0x18, 0x00 }, // <
+            { 0x00, 0x00, 0x3f, 0x00, 0x00, 0x3f, 0x00, 0x00 }, // =
+            { 0x06, 0x0c, 0x18, 0x30, 0x18, 0x0c, 0x06, 0x00 }, // >
+            { 0x1e, 0x33, 0x30, 0x18, 0x0c, 0x00, 0x0c, 0x00 }, // ?
+            { 0x3e, 0x63, 0x7b, 0x7b, 0x7b, 0x03, 0x1e, 0x00 }, // @
+            { 0x0c, 0x1e, 0x33, 0x33, 0x3f, 0x33, 0x33, 0x00 }, // A
+            { 0x3f, 0x66, 0x66, 0x3e, 0x66, 0x66, 0x3f, 0x00 }, // B
+            { 0x3c, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3c, 0x00 }, // C
+            { 0x1f, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1f, 0x00 }, // D
+            { 0x7f, 0x46, 0x16, 0x1e, 0x16, 0x46, 0x7f, 0x00 }, // E
+            { 0x7f, 0x46, 0x16, 0x1e, 0x16, 0x06, 0x0f, 0x00 }, // F
+            { 0x3c, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7c, 0x00 }, // G
+            { 0x33, 0x33, 0x33, 0x3f, 0x33, 0x33, 0x33, 0x00 }, // H
+            { 0x1e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 }, // I
+            { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1e, 0x00 }, // J
+            { 0x67, 0x66, 0x36, 0x1e, 0x36, 0x66, 0x67, 0x00 }, // K
+            { 0x0f, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7f, 0x00 }, // L
+            { 0x63, 0x77, 0x7f, 0x7f, 0x6b, 0x63, 0x63, 0x00 }, // M
+            { 0x63, 0x67, 0x6f, 0x7b, 0x73, 0x63, 0x63, 0x00 }, // N
+            { 0x1c, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1c, 0x00 }, // O
+            { 0x3f, 0x66, 0x66, 0x3e, 0x06, 0x06, 0x0f, 0x00 }, // P
+            { 0x1e, 0x33, 0x33, 0x33, 0x3b, 0x1e, 0x38, 0x00 }, // Q
+            { 0x3f, 0x66, 0x66, 0x3e, 0x36, 0x66, 0x67, 0x00 }, // R
+            { 0x1e, 0x33, 0x07, 0x0e, 0x38, 0x33, 0x1e, 0x00 }, // S
+            { 0x3f, 0x2d, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 }, // T
+            { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3f, 0x00 }, // U
+            { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x00 }, // V
+            { 0x63, 0x63, 0x63, 0x6b, 0x7f, 0x77, 0x63, 0x00 }, // W
+            { 0x63, 0x63, 0x36, 0x1c, 0x1c, 0x36, 0x63, 0x00 }, // X
+            { 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x0c, 0x1e, 0x00 }, // Y
+            { 0x7f, 0x63, 0x31, 0x18, 0x4c, 0x66, 0x7f, 0x00 }, // Z
+            { 0x1e, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1e, 0x00 }, // [
+            { 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x40, 0x00 }, // backslash
+            { 0x1e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1e, 0x00 }, // ]
+            { 0x08, 0x1c, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 }, // ^
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff }, // _
+            { 0x0c, 0x0c, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 }, // `
+            { 0x00, 0x00, 0x1e, 0x30, 0x3e, 0x33, 0x6e, 0x00 }, // a
+            { 0x07, 0x06, 0x06, 0x3e, 0x66, 0x66, 0x3b, 0x00 }, // b
+            { 0x00, 0x00, 0x1e, 0x33, 0x03, 0x33, 0x1e, 0x00 }, // c
+            { 0x38, 0x30, 0x30, 0x3e, 0x33, 0x33, 0x6e, 0x00 }, // d
+            { 0x00, 0x00, 0x1e, 0x33, 0x3f, 0x03, 0x1e, 0x00 }, // e
+            { 0x1c, 0x36, 0x06, 0x0f, 0x06, 0x06, 0x0f, 0x00 }, // f
+            { 0x00, 0x00, 0x6e, 0x33, 0x33, 0x3e, 0x30, 0x1f }, // g
+            { 0x07, 0x06, 0x36, 0x6e, 0x66, 0x66, 0x67, 0x00 }, // h
+            { 0x0c, 0x00, 0x0e, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 }, // i
+            { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1e }, // j
+            { 0x07, 0x06, 0x66, 0x36, 0x1e, 0x36, 0x67, 0x00 }, // k
+            { 0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 }, // l
+            { 0x00, 0x00, 0x33, 0x7f, 0x7f, 0x6b, 0x63, 0x00 }, // m
+            { 0x00, 0x00, 0x1f, 0x33, 0x33, 0x33, 0x33, 0x00 }, // n
+            { 0x00, 0x00, 0x1e, 0x33, 0x33, 0x33, 0x1e, 0x00 }, // o
+            { 0x00, 0x00, 0x3b, 0x66, 0x66, 0x3e, 0x06, 0x0f }, // p
+            { 0x00, 0x00, 0x6e, 0x33, 0x33, 0x3e, 0x30, 0x78 }, // q
+            { 0x00, 0x00, 0x3b, 0x6e, 0x66, 0x06, 0x0f, 0x00 }, // r
+            { 0x00, 0x00, 0x3e, 0x03, 0x1e, 0x30, 0x1f, 0x00 }, // s
+            { 0x08, 0x0c, 0x3e, 0x0c, 0x0c, 0x2c, 0x18, 0x00 }, // t
+            { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6e, 0x00 }, // u
+            { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x00 }, // v
+            { 0x00, 0x00, 0x63, 0x6b, 0x7f, 0x7f, 0x36, 0x00 }, // w
+            { 0x00, 0x00, 0x63, 0x36, 0x1c, 0x36, 0x63, 0x00 }, // x
+            { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3e, 0x30, 0x1f }, // y
+            { 0x00, 0x00, 0x3f, 0x19, 0x0c, 0x26, 0x3f, 0x00 }, // z
+            { 0x38, 0x0c, 0x0c, 0x07, 0x0c, 0x0c, 0x38, 0x00 }, // {
+            { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 }, // |
+            { 0x07, 0x0c, 0x0c, 0x38, 0x0c, 0x0c, 0x07, 0x00 }, // }
+            { 0x6e, 0x3b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ~
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // del
+        };
+
+        return glyphs;
+    }
+
+    void build_glyph_cache()
+    {
+        for (int g = 0; g < 96; ++g)
+        {
+            for (int row = 0; row < glyph_size; ++row)
+            {
+                for (int col = 0; col < glyph_size; ++col)
+                {
+                    m_glyphs[g][row][col] = ((font()[g][row] >> col) & 1) ? m_foreground : m_background;
+                }
+            }
+        }
+    }
+
+    void rasterize_line(int index)
+    {
+        const std::string& text = m_lines[index];
+        uint8_t* image = &m_image[index * glyph_size * image_pitch];
+
+        for (int row = 0; row < glyph_size; ++row)
+        {
+            uint8_t* dst = image + row * image_pitch;
+
+            for (int col = 0; col < max_columns; ++col)
+            {
+                int c = col < static_cast<int>(text.size()) ? static_cast<uint8_t>(text[col]) : ' ';
+                int g = (c >= 32 && c < 128) ? c - 32 : '?' - 32;
+                memcpy(dst + col * glyph_size, m_glyphs[g][row], glyph_size);
+            }
+        }
+    }
+
+    std::vector<std::string> m_lines;
+    std::vector<uint8_t> m_image;
+    uint8_t m_glyphs[96][glyph_size][glyph_size];
+    uint8_t m_foreground = 15;
+    uint8_t m_background = 0;
+};
+
+//===================================================================================================================================================
+//
+// Pixel formats
+//
+//===================================================================================================================================================
+
+// Frame buffer formats for BasicVgfw. to_xrgb() gives a pixel's color as 0x00rrggbb for presentation, from_xrgb() and
+// from_rgb() make a pixel from a color (true color formats only).
+
+// Palette indices, looked up at present time so palette effects and color tables apply
+struct VgfwIndexed8
+{
+    typedef uint8_t Pixel;
+    static const bool indexed = true;
+
+    static uint32_t to_xrgb(Pixel p, const uint32_t* palette) { return palette[p]; }
+};
+
+struct VgfwRgb565
+{
+    typedef uint16_t Pixel;
+    static const bool indexed = false;
+
+    static Pixel from_rgb(int r, int g, int b) { return static_cast<Pixel>(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)); }
+    static Pixel from_xrgb(uint32_t c) { return from_rgb((c >> 16) & 255, (c >> 8) & 255, c & 255); }
+
+    // Widen each channel by repeating its top bits, so full intensity stays 255
+    static uint32_t to_xrgb(Pixel p, const uint32_t*)
+    {
+        uint32_t r = (p >> 11) & 31;
+        uint32_t g = (p >> 5) & 63;
+        uint32_t b = p & 31;
+        return (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+    }
+};
+
+struct VgfwXrgb8888
+{
+    typedef uint32_t Pixel;
+    static const bool indexed = false;
+
+    static Pixel from_rgb(int r, int g, int b) { return static_cast<Pixel>((r << 16) | (g << 8) | b); }
+    static Pixel from_xrgb(uint32_t c) { return c & 0xffffff; }
+    static uint32_t to_xrgb(Pixel p, const uint32_t*) { return p & 0xffffff; }
+};
+
+//===================================================================================================================================================
+//
+// Surfaces
+//
+//===================================================================================================================================================
+
+// Owns a width x height array of T, for color, depth or any other per-pixel data. The array is aligned to 64 bytes and each
+// row is padded to a whole number of cache lines, plus one more line when the row size is a multiple of 256 bytes so that
+// walking down a column doesn't keep landing in the same cache sets.
+template <typename T>
+class VgfwSurface
+{
+public:
+    static const size_t alignment = 64;
+    static_assert(alignment % sizeof(T) == 0, "VgfwSurface elements must divide the cache line size");
+
+    VgfwSurface() = default;
+    VgfwSurface(int width, int height) { allocate(width, height); }
+
+    // Allocate zeroed storage, replacing any previous contents
+    void allocate(int width, int height)
+    {
+        size_t row_bytes = (width * sizeof(T) + alignment - 1) & ~(alignment - 1);
+        row_bytes += row_bytes % 256 == 0 ? alignment : 0;
+
+        m_storage.reset(new uint8_t[row_bytes * height + alignment - 1]);
+        uintptr_t address = reinterpret_cast<uintptr_t>(m_storage.get());
+        m_data = reinterpret_cast<T*>((address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1));
+        m_width = width;
+        m_height = height;
+        m_pitch = static_cast<int>(row_bytes / sizeof(T));
+        memset(m_data, 0, row_bytes * height);
+    }
+
+    void release()
+    {
+        m_storage.reset();
+        m_data = nullptr;
+        m_width = m_height = m_pitch = 0;
+    }
+
+    // Set every element, padding included
+    void fill(const T& value) { std::fill(m_data, m_data + size(), value); }
+
+    // Fill rows [first, last), padding included, with non-temporal stores that go straight to memory instead of evicting
+    // whatever is in the cache. Worth it for surfaces too big to stay cached between the clear and the next use.
+    void stream_fill(const T& value, int first, int last)
+    {
+        T* begin = row(first);
+        T* end = row(last);
+
+#if VGFW_SSE2
+        if (16 % sizeof(T) == 0)
+        {
+            // Rows start on cache lines and span whole ones, so the range is made of aligned 64 byte blocks
+            alignas(16) T pattern[16 / sizeof(T)];
+            std::fill(pattern, pattern + 16 / sizeof(T), value);
+            __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern));
+
+            for (uint8_t* p = reinterpret_cast<uint8_t*>(begin); p < reinterpret_cast<uint8_t*>(end); p += 64)
+            {
+                _mm_stream_si128(reinterpret_cast<__m128i*>(p), v);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(p + 16), v);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(p + 32), v);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(p + 48), v);
+            }
+
+            // Streaming stores are weakly ordered, so make them visible before anything else reads the rows
+            _mm_sfence();
+            return;
+        }
+#endif
+
+        std::fill(begin, end, value);
+    }
+
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+    T* row(int y) { return m_data + static_cast<size_t>(y) * m_pitch; }
+    const T* row(int y) const { return m_data + static_cast<size_t>(y) * m_pitch; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    // Elements between the starts of consecutive rows
+    int pitch() const { return m_pitch; }
+
+    // Elements in all rows including padding
+    size_t size() const { return static_cast<size_t>(m_pitch) * m_height; }
+
+private:
+    std::unique_ptr<uint8_t[]> m_storage;
+    T* m_data = nullptr;
+    int m_width = 0;
+    int m_height = 0;
+    int m_pitch = 0;
+};
+
+// One column of a view, top to bottom. skipped is the number of pixels clipped off the top of the requested column.
+template <typename T>
+struct VgfwBasicColumn
+{
+    T* pixels;
+    int pitch;
+    int count;
+    int skipped;
+
+    T& operator[](int i) const { return pixels[i * pitch]; }
+};
+
+// A rectangle of pixels whose rows start pitch pixels apart. left and top give its position on the screen. The span and
+// column calls take view coordinates and clip once per call, so inner loops can run over row() or a column unchecked.
+template <typename T>
+struct VgfwBasicView
+{
+    T* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int pitch = 0;
+    int left = 0;
+    int top = 0;
+
+    bool empty() const { return width <= 0 || height <= 0; }
+    T* row(int y) const { return pixels + y * pitch; }
+
+    // Fill count pixels rightwards from (x, y)
+    void fill_span(int x, int y, int count, T color) const
+    {
+        int skipped;
+
+        if (clip_span(x, y, count, skipped))
+        {
+            std::fill(row(y) + x, row(y) + x + count, color);
+        }
+    }
+
+    void copy_span(int x, int y, const T* src, int count) const
+    {
+        int skipped;
+
+        if (clip_span(x, y, count, skipped))
+        {
+            memcpy(row(y) + x, src + skipped, count * sizeof(T));
+        }
+    }
+
+    // The pixels of column x from y down, for up to count pixels
+    VgfwBasicColumn<T> column(int x, int y, int count) const
+    {
+        VgfwBasicColumn<T> column = { nullptr, pitch, 0, 0 };
+
+        if (x < 0 || x >= width)
+        {
+            return column;
+        }
+
+        column.skipped = y < 0 ? -y : 0;
+        y += column.skipped;
+        count -= column.skipped;
+        column.count = count < height - y ? count : height - y;
+        column.count = column.count > 0 ? column.count : 0;
+        column.pixels = pixels + y * pitch + x;
+        return column;
+    }
+
+    void fill_column(int x, int y, int count, T color) const
+    {
+        VgfwBasicColumn<T> pixels = column(x, y, count);
+
+        for (int i = 0; i < pixels.count; ++i)
+        {
+            pixels[i] = color;
+        }
+    }
+
+    void fill(T color) const
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            std::fill(row(y), row(y) + width, color);
+        }
+    }
+
+    // The part of this view covered by a rectangle in view coordinates
+    VgfwBasicView sub_view(int x, int y, int w, int h) const
+    {
+        int x0 = x > 0 ? x : 0;
+        int y0 = y > 0 ? y : 0;
+        int x1 = x + w < width ? x + w : width;
+        int y1 = y + h < height ? y + h : height;
+
+        VgfwBasicView view;
+        view.pitch = pitch;
+
+        if (x1 > x0 && y1 > y0)
+        {
+            view.pixels = pixels + y0 * pitch + x0;
+            view.width = x1 - x0;
+            view.height = y1 - y0;
+            view.left = left + x0;
+            view.top = top + y0;
+        }
+
+        return view;
+    }
+
+private:
+    // Clip a horizontal span to the view. skipped is how many pixels came off its left end.
+    bool clip_span(int& x, int y, int& count, int& skipped) const
+    {
+        skipped = x < 0 ? -x : 0;
+        x += skipped;
+        count -= skipped;
+        count = count < width - x ? count : width - x;
+        return y >= 0 && y < height && count > 0;
+    }
+};
+
+// A line for BasicVgfw::draw_lines()
+template <typename T>
+struct VgfwBasicLine
+{
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+    T color;
+};
+
+typedef VgfwBasicColumn<uint8_t> VgfwColumn;
+typedef VgfwBasicView<uint8_t> VgfwView;
+typedef VgfwBasicLine<uint8_t> VgfwLine;
+
+//===================================================================================================================================================
+//
+// Palette animation
+//
+//===================================================================================================================================================
+
+// Timed palette effects applied on top of a base palette: rotating ranges of entries, and fades between the (rotated) base
+// and another palette. Effects never touch pixels, so a full-screen fade costs 256 blends a frame.
+class VgfwPaletteAnimation
+{
+public:
+    // Rotate entries [first, first + count) up by one every period seconds, or down with a negative period. With smooth set,
+    // entries blend between steps rather than jumping.
+    void add_cycle(int first, int count, float period, bool smooth = false)
+    {
+        if (first < 0 || count < 2 || first + count > 256 || period == 0.0f)
+        {
+            return;
+        }
+
+        Cycle cycle = { first, count, period, smooth, 0.0f };
+        m_cycles.push_back(cycle);
+    }
+
+    void clear_cycles() { m_cycles.clear(); }
+
+    // Fade from what is showing now to target over seconds, then hold target
+    void fade_to(const uint32_t* target, float seconds)
+    {
+        start_fade(seconds);
+        memcpy(m_fade_to, target, sizeof(m_fade_to));
+        m_fade_to_base = false;
+    }
+
+    // Fade from what is showing now back to the base palette
+    void fade_to_base(float seconds)
+    {
+        start_fade(seconds);
+        m_fade_to_base = true;
+    }
+
+    // Show every entry as color (0x00rrggbb), then fade back to the base palette over seconds
+    void flash(uint32_t color, float seconds)
+    {
+        std::fill(m_fade_from, m_fade_from + 256, color);
+        m_fade_time = 0.0f;
+        m_fade_duration = seconds;
+        m_fading = true;
+        m_fade_to_base = true;
+    }
+
+    bool fading() const { return m_fading && m_fade_time < m_fade_duration; }
+
+    void advance(float delta)
+    {
+        for (Cycle& cycle : m_cycles)
+        {
+            // Keep the phase within one full rotation so it doesn't lose precision over long runs
+            float steps = cycle.count * (cycle.period > 0.0f ? cycle.period : -cycle.period);
+            cycle.time = fmodf(cycle.time + delta, steps);
+        }
+
+        if (m_fading)
+        {
+            m_fade_time += delta;
+
+            // A finished fade back to the base palette has nothing left to do
+            if (m_fade_to_base && m_fade_time >= m_fade_duration)
+            {
+                m_fading = false;
+            }
+        }
+    }
+
+    // Write base with the current effects applied to out
+    void apply(const uint32_t* base, uint32_t* out)
+    {
+        memcpy(out, base, 256 * sizeof(uint32_t));
+
+        for (const Cycle& cycle : m_cycles)
+        {
+            float steps = cycle.time / cycle.period;
+            float whole = floorf(steps);
+            int shift = static_cast<int>(whole) % cycle.count;
+            shift = shift < 0 ? shift + cycle.count : shift;
+            int weight = cycle.smooth ? static_cast<int>((steps - whole) * 256.0f + 0.5f) : 0;
+            uint32_t range[256];
+
+            for (int i = 0; i < cycle.count; ++i)
+            {
+                // Entry i shows what was shift entries below it, blending towards the one below that
+                int from = (i - shift + cycle.count) % cycle.count;
+                int next = (from - 1 + cycle.count) % cycle.count;
+                range[i] = blend(out[cycle.first + from], out[cycle.first + next], weight);
+            }
+
+            memcpy(out + cycle.first, range, cycle.count * sizeof(uint32_t));
+        }
+
+        if (m_fading)
+        {
+            float t = m_fade_duration > 0.0f ? m_fade_time / m_fade_duration : 1.0f;
+            int weight = t >= 1.0f ? 256 : static_cast<int>(t * 256.0f + 0.5f);
+            const uint32_t* to = m_fade_to_base ? out : m_fade_to;
+
+            for (int i = 0; i < 256; ++i)
+            {
+                out[i] = blend(m_fade_from[i], to[i], weight);
+            }
+        }
+
+        memcpy(m_current, out, sizeof(m_current));
+    }
+
+    // Blend two 0x00rrggbb colors, weight 0 giving a and 256 giving b
+    static uint32_t blend(uint32_t a, uint32_t b, int weight)
+    {
+        uint32_t rb = ((a & 0xff00ff) * (256 - weight) + (b & 0xff00ff) * weight + 0x800080) >> 8;
+        uint32_t g = ((a & 0x00ff00) * (256 - weight) + (b & 0x00ff00) * weight + 0x008000) >> 8;
+        return (rb & 0xff00ff) | (g & 0x00ff00);
+    }
+
+private:
+    struct Cycle
+    {
+        int first;
+        int count;
+        float period;
+        bool smooth;
+        float time;
+    };
+
+    void start_fade(float seconds)
+    {
+        // Start from the palette last produced by apply(), so a fade that interrupts another one doesn't jump
+        memcpy(m_fade_from, m_current, sizeof(m_fade_from));
+        m_fade_time = 0.0f;
+        m_fade_duration = seconds;
+        m_fading = true;
+    }
+
+    std::vector<Cycle> m_cycles;
+    uint32_t m_fade_from[256];
+    uint32_t m_fade_to[256];
+    uint32_t m_current[256] = {};
+    float m_fade_time = 0.0f;
+    float m_fade_duration = 0.0f;
+    bool m_fading = false;
+    bool m_fade_to_base = false;
+};
+
+//===================================================================================================================================================
+//
+// Color tables
+//
+//===================================================================================================================================================
+
+// Index of the palette entry closest to rgb (0x00rrggbb)
+inline uint8_t vgfw_nearest_color(const uint32_t* palette, uint32_t rgb)
+{
+    int r = (rgb >> 16) & 255;
+    int g = (rgb >> 8) & 255;
+    int b = rgb & 255;
+    int best = 0;
+    int best_distance = INT32_MAX;
+
+    for (int i = 0; i < 256; ++i)
+    {
+        int dr = static_cast<int>((palette[i] >> 16) & 255) - r;
+        int dg = static_cast<int>((palette[i] >> 8) & 255) - g;
+        int db = static_cast<int>(palette[i] & 255) - b;
+        int distance = dr * dr + dg * dg + db * db;
+
+        if (distance < best_distance)
+        {
+            best = i;
+            best_distance = distance;
+        }
+    }
+
+    return static_cast<uint8_t>(best);
+}
+
+// Maps colors to palette indices through a 32x32x32 grid. Each cell holds the entry nearest its center, for one-load lookups,
+// and the short list of entries that could be nearest to any color inside it, so nearest() is exact without a full scan.
+class VgfwInverseColormap
+{
+public:
+    void build(const uint32_t* palette)
+    {
+        m_cells.resize(cell_count);
+        m_candidate_start.resize(cell_count + 1);
+        m_candidates.clear();
+
+        // Squared distances are separable, so tabulate each entry's distance to the center, nearest and farthest point of every
+        // cell along each channel once and sum three of them per cell
+        std::vector<AxisDistance> axes(3 * 32 * 256);
+
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int k = 0; k < 32; ++k)
+            {
+                int lo = k << 3;
+
+                for (int i = 0; i < 256; ++i)
+                {
+                    int value = static_cast<int>((palette[i] >> (16 - c * 8)) & 255);
+                    int below = lo - value;
+                    int above = value - (lo + 7);
+                    int inside = below > 0 ? below : (above > 0 ? above : 0);
+                    int outside = (std::max)(std::abs(value - lo), std::abs(value - (lo + 7)));
+                    AxisDistance& axis = axes[(c * 32 + k) * 256 + i];
+                    axis.center = (value - (lo + 4)) * (value - (lo + 4));
+                    axis.inside = inside * inside;
+                    axis.outside = outside * outside;
+                }
+            }
+        }
+
+        for (int cell = 0; cell < cell_count; ++cell)
+        {
+            const AxisDistance* red = &axes[(cell >> 10) * 256];
+            const AxisDistance* green = &axes[(32 + ((cell >> 5) & 31)) * 256];
+            const AxisDistance* blue = &axes[(64 + (cell & 31)) * 256];
+            int best = 0;
+            int best_distance = INT32_MAX;
+            int bound = INT32_MAX;
+            int reach[256];
+
+            for (int i = 0; i < 256; ++i)
+            {
+                int distance = red[i].center + green[i].center + blue[i].center;
+                int farthest_in_cell = red[i].outside + green[i].outside + blue[i].outside;
+
+                if (distance < best_distance)
+                {
+                    best = i;
+                    best_distance = distance;
+                }
+
+                bound = farthest_in_cell < bound ? farthest_in_cell : bound;
+                reach[i] = red[i].inside + green[i].inside + blue[i].inside;
+            }
+
+            // Any entry closer to some point of the cell than the best worst case is a candidate
+            m_cells[cell] = static_cast<uint8_t>(best);
+            m_candidate_start[cell] = static_cast<uint32_t>(m_candidates.size());
+
+            for (int i = 0; i < 256; ++i)
+            {
+                if (reach[i] <= bound)
+                {
+                    m_candidates.push_back(static_cast<uint8_t>(i));
+                }
+            }
+        }
+
+        m_candidate_start[cell_count] = static_cast<uint32_t>(m_candidates.size());
+        memcpy(m_palette, palette, sizeof(m_palette));
+    }
+
+    // Approximate nearest entry, exact to within the 8 levels per channel of a cell
+    uint8_t lookup(int r, int g, int b) const { return m_cells[((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3)]; }
+
+    // The entry nearest to the color, the lowest index on ties
+    uint8_t nearest(int r, int g, int b) const
+    {
+        int cell = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+        int best = 0;
+        int best_distance = INT32_MAX;
+
+        for (uint32_t i = m_candidate_start[cell]; i < m_candidate_start[cell + 1]; ++i)
+        {
+            uint32_t color = m_palette[m_candidates[i]];
+            int dr = static_cast<int>((color >> 16) & 255) - r;
+            int dg = static_cast<int>((color >> 8) & 255) - g;
+            int db = static_cast<int>(color & 255) - b;
+            int distance = dr * dr + dg * dg + db * db;
+
+            if (distance < best_distance)
+            {
+                best = m_candidates[i];
+                best_distance = distance;
+            }
+        }
+
+        return static_cast<uint8_t>(best);
+    }
+
+    uint8_t nearest(uint32_t rgb) const { return nearest((rgb >> 16) & 255, (rgb >> 8) & 255, rgb & 255); }
+
+private:
+    struct AxisDistance
+    {
+        int center;
+        int inside;
+        int outside;
+    };
+
+    static const int cell_count = 32 * 32 * 32;
+
+    std::vector<uint8_t> m_cells;
+    std::vector<uint32_t> m_candidate_start;
+    std::vector<uint8_t> m_candidates;
+    uint32_t m_palette[256];
+};
+
+// Lookup tables that turn shading and blending of palette indices into a single load: light levels x 256 colors, and 256 x 256
+// tables for 50% translucency and additive blending. Built for one palette; entries are the nearest palette color to the result.
+class VgfwColorTables
+{
+public:
+    // Level 0 of the shade table is fog_color and level shade_levels - 1 is the palette itself
+    void build(const uint32_t* palette, const VgfwInverseColormap& colormap, int shade_levels, uint32_t fog_color = 0)
+    {
+        m_shade_levels = shade_levels < 2 ? 2 : shade_levels;
+        m_shade.resize(m_shade_levels * 256);
+
+        for (int level = 0; level < m_shade_levels; ++level)
+        {
+            int weight = level * 256 / (m_shade_levels - 1);
+
+            for (int c = 0; c < 256; ++c)
+            {
+                m_shade[level * 256 + c] = colormap.nearest(VgfwPaletteAnimation::blend(fog_color, palette[c], weight));
+            }
+        }
+
+        m_translucent.resize(256 * 256);
+        m_additive.resize(256 * 256);
+
+        for (int src = 0; src < 256; ++src)
+        {
+            for (int dst = 0; dst < 256; ++dst)
+            {
+                uint32_t a = palette[src];
+                uint32_t b = palette[dst];
+                uint32_t sum_rb = (a & 0xff00ff) + (b & 0xff00ff);
+                uint32_t sum_g = (a & 0x00ff00) + (b & 0x00ff00);
+
+                // Saturate each channel that carried into the bit above it
+                uint32_t r = sum_rb & 0x1000000 ? 0xff0000 : sum_rb & 0xff0000;
+                uint32_t g = sum_g & 0x10000 ? 0x00ff00 : sum_g;
+                uint32_t bl = sum_rb & 0x100 ? 0x0000ff : sum_rb & 0x0000ff;
+
+                m_translucent[src * 256 + dst] = colormap.nearest(VgfwPaletteAnimation::blend(a, b, 128));
+                m_additive[src * 256 + dst] = colormap.nearest(r | g | bl);
+            }
+        }
+    }
+
+    int shade_levels() const { return m_shade_levels; }
+
+    // The 256 entry table for a light level, from 0 (fog) to shade_levels() - 1 (full brightness)
+    const uint8_t* shade(int level) const { return m_shade.data() + level * 256; }
+
+    // Rows for drawing src over arbitrary destination pixels: row[dst] is the blended color
+    const uint8_t* translucent_row(uint8_t src) const { return m_translucent.data() + src * 256; }
+    const uint8_t* additive_row(uint8_t src) const { return m_additive.data() + src * 256; }
+
+    uint8_t translucent(uint8_t src, uint8_t dst) const { return m_translucent[src * 256 + dst]; }
+    uint8_t additive(uint8_t src, uint8_t dst) const { return m_additive[src * 256 + dst]; }
+
+private:
+    int m_shade_levels = 0;
+    std::vector<uint8_t> m_shade;
+    std::vector<uint8_t> m_translucent;
+    std::vector<uint8_t> m_additive;
+};
+
+//===================================================================================================================================================
+//
+// Sprites
+//
+//===================================================================================================================================================
+
+// An 8-bit image with transparency, stored as runs of opaque pixels per row so that drawing it only visits opaque pixels.
+// Sprites can be up to max_width pixels wide, as runs keep 16-bit positions and lengths.
+// Build one from indexed pixels with a color key, or from the RGB/RGBA pixels stb_image decodes, e.g.
+//
+//     uint8_t* rgba = stbi_load("sprite.png", &w, &h, &comp, 4);
+//     sprite.from_rgb(rgba, w, h, 4, inverse_colormap(), 0xff00ff);
+class VgfwSprite
+{
+public:
+    static const int max_width = 65535;
+
+    // Pixels equal to key are transparent. Returns false, leaving the sprite empty, if the image is wider than max_width.
+    bool from_indexed(const uint8_t* pixels, int width, int height, int pitch, uint8_t key)
+    {
+        if (!fits(width, height))
+        {
+            begin(0, 0);
+            return false;
+        }
+
+        begin(width, height);
+
+        for (int y = 0; y < height; ++y)
+        {
+            const uint8_t* row = pixels + static_cast<size_t>(y) * pitch;
+
+            for (int x = 0; x < width;)
+            {
+                if (row[x] == key)
+                {
+                    ++x;
+                    continue;
+                }
+
+                int start = x;
+
+                while (x < width && row[x] != key)
+                {
+                    ++x;
+                }
+
+                add_run(start, row + start, x - start);
+            }
+
+            end_row();
+        }
+
+        return true;
+    }
+
+    // channels is 3 or 4. Pixels whose color is key_rgb (0xrrggbb), or whose alpha is below 128, are transparent. The others are
+    // mapped to the nearest color in palette. Returns false, leaving the sprite empty, if the image is wider than max_width.
+    bool from_rgb(const uint8_t* pixels, int width, int height, int channels, const VgfwInverseColormap& colormap, uint32_t key_rgb)
+    {
+        if (!fits(width, height))
+        {
+            begin(0, 0);
+            return false;
+        }
+
+        std::vector<uint8_t> indexed(static_cast<size_t>(width) * height);
+        std::vector<uint8_t> opaque(indexed.size());
+
+        for (size_t i = 0; i < indexed.size(); ++i)
+        {
+            const uint8_t* src = pixels + i * channels;
+            uint32_t rgb = (src[0] << 16) | (src[1] << 8) | src[2];
+            opaque[i] = rgb != key_rgb && (channels < 4 || src[3] >= 128);
+            indexed[i] = opaque[i] ? colormap.nearest(rgb) : 0;
+        }
+
+        begin(width, height);
+
+        for (int y = 0; y < height; ++y)
+        {
+            const uint8_t* row = indexed.data() + static_cast<size_t>(y) * width;
+            const uint8_t* mask = opaque.data() + static_cast<size_t>(y) * width;
+
+            for (int x = 0; x < width;)
+            {
+                if (!mask[x])
+                {
+                    ++x;
+                    continue;
+                }
+
+                int start = x;
+
+                while (x < width && mask[x])
+                {
+                    ++x;
+                }
+
+                add_run(start, row + start, x - start);
+            }
+
+            end_row();
+        }
+
+        return true;
+    }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    size_t opaque_count() const { return m_pixels.size(); }
+
+    // Draw with the top left corner at (x, y) in the target view's coordinates, clipped to the view
+    void draw(const VgfwView& target, int x, int y, bool flip_x = false) const
+    {
+        int row_begin = y < 0 ? -y : 0;
+        int row_end = target.height - y < m_height ? target.height - y : m_height;
+
+        // Visible columns in sprite space
+        int visible_begin = flip_x ? m_width - (target.width - x) : -x;
+        int visible_end = flip_x ? m_width + x : target.width - x;
+
+        for (int row = row_begin; row < row_end; ++row)
+        {
+            uint8_t* dst_row = target.row(y + row) + x;
+
+            for (uint32_t r = m_row_runs[row]; r < m_row_runs[row + 1]; ++r)
+            {
+                const Run& run = m_runs[r];
+                int begin = run.x > visible_begin ? run.x : visible_begin;
+                int end = run.x + run.length < visible_end ? run.x + run.length : visible_end;
+
+                if (begin >= end)
+                {
+                    continue;
+                }
+
+                const uint8_t* src = m_pixels.data() + run.offset + (begin - run.x);
+
+                if (!flip_x)
+                {
+                    memcpy(dst_row + begin, src, end - begin);
+                }
+                else
+                {
+                    uint8_t* dst = dst_row + (m_width - 1 - begin);
+
+                    for (int i = 0; i < end - begin; ++i)
+                    {
+                        *dst-- = src[i];
+                    }
+                }
+            }
+        }
+    }
+
+    // Draw stretched to width x height with nearest sampling. Destination pixel (dx, dy) shows sprite pixel
+    // (dx * sprite width / width, dy * sprite height / height).
+    void draw_scaled(const VgfwView& target, int x, int y, int width, int height, bool flip_x = false) const
+    {
+        if (width <= 0 || height <= 0 || m_width == 0 || m_height == 0)
+        {
+            return;
+        }
+
+        int row_begin = y < 0 ? -y : 0;
+        int row_end = target.height - y < height ? target.height - y : height;
+        int visible_begin = flip_x ? width - (target.width - x) : -x;
+        int visible_end = flip_x ? width + x : target.width - x;
+        int64_t step_whole = m_width / width;
+        int64_t step_frac = m_width % width;
+
+        for (int row = row_begin; row < row_end; ++row)
+        {
+            int src_row = static_cast<int>(static_cast<int64_t>(row) * m_height / height);
+            uint8_t* dst_row = target.row(y + row) + x;
+
+            for (uint32_t r = m_row_runs[src_row]; r < m_row_runs[src_row + 1]; ++r)
+            {
+                // Destination columns that sample inside the run
+                const Run& run = m_runs[r];
+                int64_t run_begin = (static_cast<int64_t>(run.x) * width + m_width - 1) / m_width;
+                int64_t run_end = (static_cast<int64_t>(run.x + run.length) * width + m_width - 1) / m_width;
+                int64_t begin = run_begin > visible_begin ? run_begin : visible_begin;
+                int64_t end = run_end < visible_end ? run_end : visible_end;
+
+                if (begin >= end)
+                {
+                    continue;
+                }
+
+                const uint8_t* src = m_pixels.data() + run.offset - run.x;
+                int64_t whole = begin * m_width / width;
+                int64_t frac = begin * m_width % width;
+                uint8_t* dst = dst_row + (flip_x ? width - 1 - begin : begin);
+                int step = flip_x ? -1 : 1;
+
+                for (int64_t dx = begin; dx < end; ++dx)
+                {
+                    *dst = src[whole];
+                    dst += step;
+                    whole += step_whole;
+                    frac += step_frac;
+
+                    if (frac >= width)
+                    {
+                        frac -= width;
+                        ++whole;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Run
+    {
+        uint16_t x;
+        uint16_t length;
+        uint32_t offset;
+    };
+
+    // Run positions and lengths are 16-bit and pixel offsets 32-bit
+    static bool fits(int width, int height)
+    {
+        return width >= 0 && height >= 0 && width <= max_width && static_cast<uint64_t>(width) * height <= 0xffffffffu;
+    }
+
+    void begin(int width, int height)
+    {
+        m_width = width;
+        m_height = height;
+        m_runs.clear();
+        m_pixels.clear();
+        m_row_runs.assign(1, 0);
+    }
+
+    void add_run(int x, const uint8_t* pixels, int length)
+    {
+        Run run = { static_cast<uint16_t>(x), static_cast<uint16_t>(length), static_cast<uint32_t>(m_pixels.size()) };
+        m_runs.push_back(run);
+        m_pixels.insert(m_pixels.end(), pixels, pixels + length);
+    }
+
+    void end_row() { m_row_runs.push_back(static_cast<uint32_t>(m_runs.size())); }
+
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<Run> m_runs;
+    std::vector<uint32_t> m_row_runs;
+    std::vector<uint8_t> m_pixels;
+};
+
+//===================================================================================================================================================
+//
+// Frame capture
+//
+//===================================================================================================================================================
+
+// Capture files start with a 16 byte header (magic, then width and height as 32-bit values) followed by one record per frame.
+// A record is its payload size as a 32-bit value, then a payload of varints and bytes: the frame number, the number of palette
+// packets and the packets themselves (entries skipped, entries changed, then 4 bytes per changed entry), and finally pixel
+// packets up to the end of the payload. A pixel packet is the count of unchanged bytes to skip followed by (length << 1 | run),
+// then either the single byte repeated length times or length literal bytes. Both sides start from a zeroed frame and palette.
+namespace vgfw_capture
+{
+    static const char magic[8] = { 'V', 'G', 'F', 'W', 'C', 'A', 'P', '1' };
+
+    inline void put_varint(std::vector<uint8_t>& out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    inline bool get_varint(const uint8_t*& src, const uint8_t* end, uint64_t& value)
+    {
+        value = 0;
+
+        for (int shift = 0; src < end && shift < 64; shift += 7)
+        {
+            uint8_t byte = *src++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+            if (!(byte & 0x80))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Length of the run of equal bytes starting at data[0], up to count
+    inline size_t run_length(const uint8_t* data, size_t count)
+    {
+        size_t length = 1;
+
+        while (length < count && data[length] == data[0])
+        {
+            ++length;
+        }
+
+        return length;
+    }
+
+    // Length of the run of bytes that match prev starting at index 0, up to count
+    inline size_t same_length(const uint8_t* data, const uint8_t* prev, size_t count)
+    {
+        size_t length = 0;
+
+        while (length + 8 <= count)
+        {
+            uint64_t a, b;
+            memcpy(&a, data + length, 8);
+            memcpy(&b, prev + length, 8);
+
+            if (a != b)
+            {
+                break;
+            }
+
+            length += 8;
+        }
+
+        while (length < count && data[length] == prev[length])
+        {
+            ++length;
+        }
+
+        return length;
+    }
+}
+
+// Streams 8-bit frames to a capture file. submit() copies the frame into a bounded queue, and a background thread encodes each
+// frame as a delta against the previous one and writes it out.
+class VgfwCaptureWriter
+{
+public:
+    ~VgfwCaptureWriter() { close(); }
+
+    bool open(const char* path, int width, int height, int queue_depth = 4)
+    {
+        close();
+        m_file = fopen(path, "wb");
+
+        if (!m_file)
+        {
+            return false;
+        }
+
+        uint32_t size[2] = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+
+        if (fwrite(vgfw_capture::magic, 1, 8, m_file) != 8 || fwrite(size, sizeof(size), 1, m_file) != 1)
+        {
+            fclose(m_file);
+            m_file = nullptr;
+            return false;
+        }
+
+        size_t pixel_count = static_cast<size_t>(width) * height;
+        m_width = width;
+        m_height = height;
+        m_buffers.resize(queue_depth < 1 ? 1 : queue_depth);
+
+        for (Buffer& buffer : m_buffers)
+        {
+            buffer.pixels.assign(pixel_count, 0);
+        }
+
+        m_previous.assign(pixel_count, 0);
+        memset(m_previous_palette, 0, sizeof(m_previous_palette));
+
+        int count = static_cast<int>(m_buffers.size());
+        m_ready.reset(count);
+        m_free.reset(count);
+
+        for (int i = 0; i < count; ++i)
+        {
+            m_free.push(i);
+        }
+
+        m_stop = false;
+        m_stalls = 0;
+        m_frames_written = 0;
+        m_bytes_written = 16;
+        m_thread = std::thread(&VgfwCaptureWriter::writer_thread, this);
+        return true;
+    }
+
+    // Write out the queued frames and close the file
+    void close()
+    {
+        if (m_thread.joinable())
+        {
+            m_stop = true;
+            m_ready_signal.notify();
+            m_thread.join();
+        }
+
+        if (m_file)
+        {
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+    bool is_open() const { return m_file != nullptr; }
+
+    // Queue a frame of width x height pixels with rows pitch bytes apart. Blocks while the queue is full rather than drop frames.
+    void submit(uint64_t number, const uint8_t* pixels, int pitch, const uint32_t* palette)
+    {
+        int index;
+
+        if (!m_free.pop(index))
+        {
+            VGFW_PROFILE_ZONE("wait_for_capture");
+            ++m_stalls;
+            m_free_signal.wait([&] { return m_free.pop(index); });
+        }
+
+        Buffer& buffer = m_buffers[index];
+        buffer.number = number;
+        for (int y = 0; y < m_height; ++y)
+        {
+            memcpy(buffer.pixels.data() + static_cast<size_t>(y) * m_width, pixels + static_cast<size_t>(y) * pitch, m_width);
+        }
+
+        memcpy(buffer.palette, palette, sizeof(buffer.palette));
+
+        m_ready.push(index);
+        m_ready_signal.notify();
+    }
+
+    // Number of times submit() had to wait for the writer thread
+    uint64_t stalls() const { return m_stalls; }
+    uint64_t frames_written() const { return m_frames_written.load(); }
+    uint64_t bytes_written() const { return m_bytes_written.load(); }
+
+private:
+    struct Buffer
+    {
+        std::vector<uint8_t> pixels;
+        uint32_t palette[256];
+        uint64_t number = 0;
+    };
+
+    void writer_thread()
+    {
+        VgfwProfiler::instance().set_thread_name("capture");
+
+        for (;;)
+        {
+            m_ready_signal.wait([this] { return !m_ready.empty() || m_stop; });
+
+            // Read the flag first so a frame queued just before close() is still written
+            bool stop = m_stop;
+            int index;
+
+            if (!m_ready.pop(index))
+            {
+                if (stop)
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            write_frame(m_buffers[index]);
+
+            m_free.push(index);
+            m_free_signal.notify();
+        }
+    }
+
+    void write_frame(Buffer& buffer)
+    {
+        VGFW_PROFILE_ZONE("capture_frame");
+        m_record.clear();
+        vgfw_capture::put_varint(m_record, buffer.number);
+        encode_palette(buffer.palette);
+        encode_pixels(buffer.pixels.data());
+
+        uint32_t size = static_cast<uint32_t>(m_record.size());
+        fwrite(&size, sizeof(size), 1, m_file);
+        fwrite(m_record.data(), 1, m_record.size(), m_file);
+
+        // The buffer is overwritten by the next submit() anyway, so take its pixels rather than copy them
+        m_previous.swap(buffer.pixels);
+        memcpy(m_previous_palette, buffer.palette, sizeof(m_previous_palette));
+        ++m_frames_written;
+        m_bytes_written += sizeof(size) + size;
+    }
+
+    void encode_palette(const uint32_t* palette)
+    {
+        // Count the packets first since the count comes before them
+        int packets = 0;
+
+        for (int i = 0; i < 256;)
+        {
+            if (palette[i] == m_previous_palette[i])
+            {
+                ++i;
+                continue;
+            }
+
+            ++packets;
+
+            while (i < 256 && palette[i] != m_previous_palette[i])
+            {
+                ++i;
+            }
+        }
+
+        vgfw_capture::put_varint(m_record, packets);
+
+        for (int i = 0, last = 0; i < 256;)
+        {
+            if (palette[i] == m_previous_palette[i])
+            {
+                ++i;
+                continue;
+            }
+
+            int start = i;
+
+            while (i < 256 && palette[i] != m_previous_palette[i])
+            {
+                ++i;
+            }
+
+            vgfw_capture::put_varint(m_record, start - last);
+            vgfw_capture::put_varint(m_record, i - start);
+
+            for (int entry = start; entry < i; ++entry)
+            {
+                for (int byte = 0; byte < 4; ++byte)
+                {
+                    m_record.push_back(static_cast<uint8_t>(palette[entry] >> (byte * 8)));
+                }
+            }
+
+            last = i;
+        }
+    }
+
+    // Changed bytes go out as runs where at least min_run repeat and as literals otherwise. Unchanged gaps shorter than min_run
+    // are folded into the surrounding literal, since a new packet would cost more than the bytes it skips.
+    void encode_pixels(const uint8_t* pixels)
+    {
+        static const size_t min_run = 4;
+        const uint8_t* prev = m_previous.data();
+        size_t count = m_previous.size();
+        size_t i = 0;
+
+        while (i < count)
+        {
+            size_t skip = vgfw_capture::same_length(pixels + i, prev + i, count - i);
+            i += skip;
+
+            if (i == count)
+            {
+                break;
+            }
+
+            vgfw_capture::put_varint(m_record, skip);
+            size_t run = vgfw_capture::run_length(pixels + i, count - i);
+
+            if (run >= min_run)
+            {
+                vgfw_capture::put_varint(m_record, (run << 1) | 1);
+                m_record.push_back(pixels[i]);
+                i += run;
+                continue;
+            }
+
+            size_t end = i;
+
+            while (end < count)
+            {
+                size_t same = vgfw_capture::same_length(pixels + end, prev + end, count - end);
+
+                if (same >= min_run || end + same == count)
+                {
+                    break;
+                }
+
+                end += same;
+                size_t next_run = vgfw_capture::run_length(pixels + end, count - end);
+
+                if (next_run >= min_run)
+                {
+                    break;
+                }
+
+                end += next_run;
+            }
+
+            vgfw_capture::put_varint(m_record, (end - i) << 1);
+            m_record.insert(m_record.end(), pixels + i, pixels + end);
+            i = end;
+        }
+    }
+
+    FILE* m_file = nullptr;
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<Buffer> m_buffers;
+    VgfwSpscRing<int> m_ready;
+    VgfwSpscRing<int> m_free;
+    VgfwSignal m_ready_signal;
+    VgfwSignal m_free_signal;
+    std::thread m_thread;
+    std::atomic<bool> m_stop{ false };
+    uint64_t m_stalls = 0;
+    std::atomic<uint64_t> m_frames_written{ 0 };
+    std::atomic<uint64_t> m_bytes_written{ 0 };
+
+    // Only touched by the writer thread
+    std::vector<uint8_t> m_previous;
+    uint32_t m_previous_palette[256];
+    std::vector<uint8_t> m_record;
+};
+
+// Reads back the frames of a file written by VgfwCaptureWriter
+class VgfwCaptureReader
+{
+public:
+    ~VgfwCaptureReader() { close(); }
+
+    bool open(const char* path)
+    {
+        close();
+        m_file = fopen(path, "rb");
+
+        if (!m_file)
+        {
+            return false;
+        }
+
+        char header[8];
+        uint32_t size[2];
+
+        if (fread(header, 1, 8, m_file) != 8 || memcmp(header, vgfw_capture::magic, 8) != 0 || fread(size, sizeof(size), 1, m_file) != 1)
+        {
+            close();
+            return false;
+        }
+
+        m_width = static_cast<int>(size[0]);
+        m_height = static_cast<int>(size[1]);
+        m_pixels.assign(static_cast<size_t>(m_width) * m_height, 0);
+        memset(m_palette, 0, sizeof(m_palette));
+        m_number = 0;
+        m_failed = false;
+        return true;
+    }
+
+    void close()
+    {
+        if (m_file)
+        {
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+    // Apply the next frame's changes. Returns false at the end of the file or if the record is truncated or malformed, which
+    // failed() tells apart.
+    bool read_frame()
+    {
+        uint32_t size;
+        size_t read = m_file ? fread(&size, 1, sizeof(size), m_file) : 0;
+
+        if (read != sizeof(size))
+        {
+            // Part of a size, or a read error, is a damaged file rather than its end
+            m_failed = read != 0 || (m_file && ferror(m_file));
+            return false;
+        }
+
+        m_failed = !read_record(size);
+        return !m_failed;
+    }
+
+    // True if the last read_frame() stopped on a damaged record rather than at the end of the file
+    bool failed() const { return m_failed; }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    // The frame number passed to VgfwCaptureWriter::submit() and the frame's contents, after read_frame()
+    uint64_t frame_number() const { return m_number; }
+    const uint8_t* pixels() const { return m_pixels.data(); }
+    const uint32_t* palette() const { return m_palette; }
+
+private:
+    bool read_record(uint32_t size)
+    {
+        m_record.resize(size);
+
+        if (fread(m_record.data(), 1, size, m_file) != size)
+        {
+            return false;
+        }
+
+        const uint8_t* src = m_record.data();
+        const uint8_t* end = src + size;
+        uint64_t packets;
+
+        if (!vgfw_capture::get_varint(src, end, m_number) || !vgfw_capture::get_varint(src, end, packets))
+        {
+            return false;
+        }
+
+        uint64_t entry = 0;
+
+        for (uint64_t packet = 0; packet < packets; ++packet)
+        {
+            uint64_t skip, count;
+
+            if (!vgfw_capture::get_varint(src, end, skip) || !vgfw_capture::get_varint(src, end, count))
+            {
+                return false;
+            }
+
+            entry += skip;
+
+            if (entry + count > 256 || static_cast<uint64_t>(end - src) < count * 4)
+            {
+                return false;
+            }
+
+            for (; count > 0; --count, ++entry, src += 4)
+            {
+                m_palette[entry] = src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+            }
+        }
+
+        uint8_t* pixels = m_pixels.data();
+        uint64_t pixel_count = m_pixels.size();
+        uint64_t offset = 0;
+
+        while (src < end)
+        {
+            uint64_t skip, code;
+
+            if (!vgfw_capture::get_varint(src, end, skip) || !vgfw_capture::get_varint(src, end, code))
+            {
+                return false;
+            }
+
+            uint64_t length = code >> 1;
+            offset += skip;
+
+            if (offset > pixel_count || length > pixel_count - offset)
+            {
+                return false;
+            }
+
+            if (code & 1)
+            {
+                if (src == end)
+                {
+                    return false;
+                }
+
+                memset(pixels + offset, *src++, length);
+            }
+            else
+            {
+                if (static_cast<uint64_t>(end - src) < length)
+                {
+                    return false;
+                }
+
+                memcpy(pixels + offset, src, length);
+                src += length;
+            }
+
+            offset += length;
+        }
+
+        return true;
+    }
+
+    FILE* m_file = nullptr;
+    bool m_failed = false;
+    int m_width = 0;
+    int m_height = 0;
+    uint64_t m_number = 0;
+    std::vector<uint8_t> m_pixels;
+    uint32_t m_palette[256];
+    std::vector<uint8_t> m_record;
+};
+
+//===================================================================================================================================================
+//
+// Frame hashing
+//
+//===================================================================================================================================================
+
+// Fast non-cryptographic 64-bit hash. Four multiply-rotate lanes over 32 byte blocks, mixed with splitmix64's finalizer.
+inline uint64_t vgfw_hash64(const void* data, size_t size, uint64_t seed = 0)
+{
+    static const uint64_t k0 = 0x9e3779b97f4a7c15ull;
+    static const uint64_t k1 = 0xbf58476d1ce4e5b9ull;
+    static const uint64_t k2 = 0x94d049bb133111ebull;
+
+    auto round = [](uint64_t lane, uint64_t word) {
+        lane ^= word * k1;
+        lane = (lane << 31) | (lane >> 33);
+        return lane * k0;
+    };
+
+    auto mix = [](uint64_t h) {
+        h = (h ^ (h >> 30)) * k1;
+        h = (h ^ (h >> 27)) * k2;
+        return h ^ (h >> 31);
+    };
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t lanes[4] = { seed + k0, seed + k1, seed + k2, seed - k0 };
+
+    for (; end - p >= 32; p += 32)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            uint64_t word;
+            memcpy(&word, p + i * 8, 8);
+            lanes[i] = round(lanes[i], word);
+        }
+    }
+
+    for (int i = 0; end - p > 0; p += 8, i = (i + 1) & 3)
+    {
+        uint64_t word = 0;
+        memcpy(&word, p, end - p < 8 ? end - p : 8);
+        lanes[i] = round(lanes[i], word);
+    }
+
+    uint64_t h = size * k2;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        h = mix(h ^ lanes[i]);
+    }
+
+    return h;
+}
+
+// Hash of the visible pixels (rows pitch pixels apart, padding ignored) and palette of a frame
+template <typename T>
+uint64_t vgfw_frame_hash(const T* pixels, int width, int height, int pitch, const uint32_t* palette)
+{
+    uint64_t h = vgfw_hash64(palette, 256 * sizeof(uint32_t));
+
+    for (int y = 0; y < height; ++y)
+    {
+        h = vgfw_hash64(pixels + static_cast<size_t>(y) * pitch, width * sizeof(T), h);
+    }
+
+    return h;
+}
+
+inline uint32_t vgfw_crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(256);
+
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+
+            t[n] = c;
+        }
+
+        return t;
+    }();
+
+    crc = ~crc;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+inline uint32_t vgfw_adler32(const uint8_t* data, size_t size, uint32_t adler = 1)
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+
+    while (size)
+    {
+        // 5552 is the most bytes that can be summed before b could overflow 32 bits
+        size_t n = size < 5552 ? size : 5552;
+        size -= n;
+
+        for (; n; --n)
+        {
+            a += *data++;
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+namespace vgfw_png
+{
+// Write a PNG of 8-bit samples: color type 3 (indexed, with a PLTE chunk) or 2 (RGB). raw holds the scanlines, each a filter
+// type byte followed by the row. It is stored uncompressed (deflate stored blocks), which keeps the encoder tiny; these files
+// are for looking at, not archiving.
+inline bool write(const char* path, int width, int height, uint8_t color_type, const std::vector<uint8_t>& plte, const std::vector<uint8_t>& raw)
+{
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    auto put32 = [](std::vector<uint8_t>& out, uint32_t v) {
+        uint8_t bytes[4] = { static_cast<uint8_t>(v >> 24), static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 8), static_cast<uint8_t>(v) };
+        out.insert(out.end(), bytes, bytes + 4);
+    };
+
+    auto chunk = [&](const char* type, const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> out;
+        put32(out, static_cast<uint32_t>(data.size()));
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        put32(out, vgfw_crc32(out.data() + 4, out.size() - 4));
+        fwrite(out.data(), 1, out.size(), file);
+    };
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, 8, file);
+
+    // 8 bits per sample, default compression and filtering, no interlace
+    std::vector<uint8_t> header;
+    put32(header, width);
+    put32(header, height);
+    header.insert(header.end(), { 8, color_type, 0, 0, 0 });
+    chunk("IHDR", header);
+
+    if (!plte.empty())
+    {
+        chunk("PLTE", plte);
+    }
+
+    // zlib stream of stored blocks of up to 65535 bytes
+    std::vector<uint8_t> idat = { 0x78, 0x01 };
+
+    for (size_t offset = 0, n; offset < raw.size(); offset += n)
+    {
+        n = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+        bool last = offset + n == raw.size();
+        idat.insert(idat.end(), { static_cast<uint8_t>(last), static_cast<uint8_t>(n), static_cast<uint8_t>(n >> 8),
+                                  static_cast<uint8_t>(~n), static_cast<uint8_t>(~n >> 8) });
+        idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + n);
+    }
+
+    put32(idat, vgfw_adler32(raw.data(), raw.size()));
+    chunk("IDAT", idat);
+    chunk("IEND", std::vector<uint8_t>());
+
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+} // namespace vgfw_png
+
+// Write an 8-bit frame as an indexed PNG
+inline bool vgfw_write_png(const char* path, const uint8_t* pixels, int width, int height, int pitch, const uint32_t* palette)
+{
+    std::vector<uint8_t> plte;
+
+    for (int i = 0; i < 256; ++i)
+    {
+        plte.insert(plte.end(), { static_cast<uint8_t>(palette[i] >> 16), static_cast<uint8_t>(palette[i] >> 8), static_cast<uint8_t>(palette[i]) });
+    }
+
+    // Each scanline is a filter type byte (0, none) then the row
+    std::vector<uint8_t> raw;
+    raw.reserve(static_cast<size_t>(width + 1) * height);
+
+    for (int y = 0; y < height; ++y)
+    {
+        const uint8_t* row = pixels + static_cast<size_t>(y) * pitch;
+        raw.push_back(0);
+        raw.insert(raw.end(), row, row + width);
+    }
+
+    return vgfw_png::write(path, width, height, 3, plte, raw);
+}
+
+// Write 0x00rrggbb pixels as an RGB PNG
+inline bool vgfw_write_png_rgb(const char* path, const uint32_t* pixels, int width, int height, int pitch)
+{
+    std::vector<uint8_t> raw;
+    raw.reserve(static_cast<size_t>(width * 3 + 1) * height);
+
+    for (int y = 0; y < height; ++y)
+    {
+        const uint32_t* row = pixels + static_cast<size_t>(y) * pitch;
+        raw.push_back(0);
+
+        for (int x = 0; x < width; ++x)
+        {
+            raw.insert(raw.end(), { static_cast<uint8_t>(row[x] >> 16), static_cast<uint8_t>(row[x] >> 8), static_cast<uint8_t>(row[x]) });
+        }
+    }
+
+    return vgfw_png::write(path, width, height, 2, std::vector<uint8_t>(), raw);
+}
+
+// A text file of frame hashes, one 16 digit hex value per line, for recording a run and checking later runs against it
+class VgfwFrameHashLog
+{
+public:
+    ~VgfwFrameHashLog() { close(); }
+
+    bool open_write(const char* path)
+    {
+        close();
+        m_file = fopen(path, "w");
+        m_writing = true;
+        return m_file != nullptr;
+    }
+
+    bool open_read(const char* path)
+    {
+        close();
+        m_file = fopen(path, "r");
+        m_writing = false;
+        return m_file != nullptr;
+    }
+
+    void close()
+    {
+        if (m_file)
+        {
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+    bool is_writing() const { return m_file && m_writing; }
+    bool is_reading() const { return m_file && !m_writing; }
+
+    void write(uint64_t hash) { fprintf(m_file, "%016llx\n", static_cast<unsigned long long>(hash)); }
+
+    // Returns false at the end of the file
+    bool read(uint64_t& hash)
+    {
+        unsigned long long value;
+
+        if (fscanf(m_file, "%llx", &value) != 1)
+        {
+            return false;
+        }
+
+        hash = value;
+        return true;
+    }
+
+private:
+    FILE* m_file = nullptr;
+    bool m_writing = false;
+};
+
+//===================================================================================================================================================
+//
+// Vgfw
+//
+//===================================================================================================================================================
+// The engine, with Format (VgfwIndexed8, VgfwRgb565 or VgfwXrgb8888) picking the type of the frame buffer's pixels. Palette
+// effects, color tables, sprites and capture only apply to 8-bit indexed frames; true color apps write colors directly.
+template <typename Format>
+class BasicVgfw
+{
+public:
+    typedef typename Format::Pixel Pixel;
+    typedef VgfwBasicView<Pixel> View;
+    typedef VgfwBasicColumn<Pixel> Column;
+    typedef VgfwBasicLine<Pixel> Line;
+
+    // Size of the area drawn this frame. It is the size passed to initialize() unless a render scale below 1 is set, in which
+    // case drawing is clipped to the top left screen_width x screen_height pixels of the frame buffers and present scales them
+    // up to fill the window.
+    int screen_width;
+    int screen_height;
+
+    // Size passed to initialize(), which the frame buffers are allocated at
+    int full_screen_width;
+    int full_screen_height;
+
+    // Bytes between the starts of consecutive rows of the frame buffers, at least screen_width
+    int screen_pitch;
+    int window_width;
+    int window_height;
+
+    // Headless runs drive the app for a fixed number of frames with a fixed delta. on_frame, if set, receives each finished
+    // frame (screen_height rows of screen_width palette indices, pitch bytes apart) and the palette it should be displayed with
+    // (0x00rrggbb entries).
+    // on_present, if set, receives the frame after palette expansion and scaling into the window sized 32-bit presentation surface.
+    // Both are called on the present thread. on_input, if set, is called on the app thread before each frame's input is
+    // processed, which is the place to script input with queue_key_event().
+    struct HeadlessOptions
+    {
+        int frame_count = 600;
+        float fixed_delta = 1.0f / 60.0f;
+        std::function<void(int frame, const Pixel* pixels, int pitch, const uint32_t* palette)> on_frame;
+        std::function<void(int frame, const uint32_t* pixels, int pitch)> on_present;
+        std::function<void(int frame)> on_input;
+    };
+
+    // How the present thread picks frames. Mailbox shows the newest finished frame and drops any older ones still queued,
+    // Fifo shows every frame in order and makes the app wait when all the buffers are queued.
+    enum class PresentMode
+    {
+        Mailbox,
+        Fifo
+    };
+
+    struct PresentStats
+    {
+        uint64_t submitted;  // frames finished by the app
+        uint64_t presented;  // frames shown by the present thread
+        uint64_t dropped;    // frames skipped because a newer one was ready
+        uint64_t duplicated; // present intervals that passed without a new frame, so the last one stayed up
+        uint64_t stalls;     // times the app had to wait for a free buffer
+    };
+
+    virtual ~BasicVgfw() = default;
+
+    virtual bool on_create() = 0;
+    virtual void on_destroy() = 0;
+    virtual bool on_update(float delta) = 0;
+
+    bool initialize(const wchar_t* name, int screen_width_ = 320, int screen_height_ = 240, int window_scale = 2)
+    {
+        m_title = name;
+
+        screen_width = screen_width_;
+        screen_height = screen_height_;
+        full_screen_width = screen_width_;
+        full_screen_height = screen_height_;
+        window_width = screen_width * window_scale;
+        window_height = screen_height * window_scale;
+
+        if (!platform_initialize())
+        {
+            return false;
+        }
+
+        int hardware_threads = static_cast<int>(std::thread::hardware_concurrency());
+        m_jobs.start(m_worker_count >= 0 ? m_worker_count : (hardware_threads > 1 ? hardware_threads - 1 : 0));
+
+        // Initialise frame buffers
+        m_frames.resize(m_frame_buffer_count);
+
+        m_tiles_x = (screen_width + dirty_tile_size - 1) / dirty_tile_size;
+        m_tiles_y = (screen_height + dirty_tile_size - 1) / dirty_tile_size;
+
+        for (Frame& frame : m_frames)
+        {
+            frame.surface.allocate(screen_width, screen_height);
+            frame.pixels = frame.surface.data();
+            frame.dirty.assign(m_tiles_x * m_tiles_y, 0);
+            frame.stale.assign(m_tiles_x * m_tiles_y, 0);
+        }
+
+        screen_pitch = m_frames[0].surface.pitch();
+        m_present_dirty.assign(m_tiles_x * m_tiles_y, 0);
+
+        // Set default palette
+        static uint32_t default_palette[256] = {
+            0x000000, 0x0000a8, 0x00a800, 0x00a8a8, 0xa80000, 0xa800a8, 0xa85400, 0xa8a8a8, 0x545454, 0x5454fc, 0x54fc54, 0x54fcfc, 0xfc5454,
+            0xfc54fc, 0xfcfc54, 0xfcfcfc, 0x000000, 0x141414, 0x202020, 0x2c2c2c, 0x383838, 0x444444, 0x505050, 0x606060, 0x707070, 0x808080,
+            0x909090, 0xa0a0a0, 0xb4b4b4, 0xc8c8c8, 0xe0e0e0, 0xfcfcfc, 0x0000fc, 0x4000fc, 0x7c00fc, 0xbc00fc, 0xfc00fc, 0xfc00bc, 0xfc007c,
+            0xfc0040, 0xfc0000, 0xfc4000, 0xfc7c00, 0xfcbc00, 0xfcfc00, 0xbcfc00, 0x7cfc00, 0x40fc00, 0x00fc00, 0x00fc40, 0x00fc7c, 0x00fcbc,
+            0x00fcfc, 0x00bcfc, 0x007cfc, 0x0040fc, 0x7c7cfc, 0x9c7cfc, 0xbc7cfc, 0xdc7cfc, 0xfc7cfc, 0xfc7cdc, 0xfc7cbc, 0xfc7c9c, 0xfc7c7c,
+            0xfc9c7c, 0xfcbc7c, 0xfcdc7c, 0xfcfc7c, 0xdcfc7c, 0xbcfc7c, 0x9cfc7c, 0x7cfc7c, 0x7cfc9c, 0x7cfcbc, 0x7cfcdc, 0x7cfcfc, 0x7cdcfc,
+            0x7cbcfc, 0x7c9cfc, 0xb4b4fc, 0xc4b4fc, 0xd8b4fc, 0xe8b4fc, 0xfcb4fc, 0xfcb4e8, 0xfcb4d8, 0xfcb4c4, 0xfcb4b4, 0xfcc4b4, 0xfcd8b4,
+            0xfce8b4, 0xfcfcb4, 0xe8fcb4, 0xd8fcb4, 0xc4fcb4, 0xb4fcb4, 0xb4fcc4, 0xb4fcd8, 0xb4fce8, 0xb4fcfc, 0xb4e8fc, 0xb4d8fc, 0xb4c4fc,
+            0x000070, 0x1c0070, 0x380070, 0x540070, 0x700070, 0x700054, 0x700038, 0x70001c, 0x700000, 0x701c00, 0x703800, 0x705400, 0x707000,
+            0x547000, 0x387000, 0x1c7000, 0x007000, 0x00701c, 0x007038, 0x007054, 0x007070, 0x005470, 0x003870, 0x001c70, 0x383870, 0x443870,
+            0x543870, 0x603870, 0x703870, 0x703860, 0x703854, 0x703844, 0x703838, 0x704438, 0x705438, 0x706038, 0x707038, 0x607038, 0x547038,
+            0x447038, 0x387038, 0x387044, 0x387054, 0x387060, 0x387070, 0x386070, 0x385470, 0x384470, 0x505070, 0x585070, 0x605070, 0x685070,
+            0x705070, 0x705068, 0x705060, 0x705058, 0x705050, 0x705850, 0x706050, 0x706850, 0x707050, 0x687050, 0x607050, 0x587050, 0x507050,
+            0x507058, 0x507060, 0x507068, 0x507070, 0x506870, 0x506070, 0x505870, 0x000040, 0x100040, 0x200040, 0x300040, 0x400040, 0x400030,
+            0x400020, 0x400010, 0x400000, 0x401000, 0x402000, 0x403000, 0x404000, 0x304000, 0x204000, 0x104000, 0x004000, 0x004010, 0x004020,
+            0x004030, 0x004040, 0x003040, 0x002040, 0x001040, 0x202040, 0x282040, 0x302040, 0x382040, 0x402040, 0x402038, 0x402030, 0x402028,
+            0x402020, 0x402820, 0x403020, 0x403820, 0x404020, 0x384020, 0x304020, 0x284020, 0x204020, 0x204028, 0x204030, 0x204038, 0x204040,
+            0x203840, 0x203040, 0x202840, 0x2c2c40, 0x302c40, 0x342c40, 0x3c2c40, 0x402c40, 0x402c3c, 0x402c34, 0x402c30, 0x402c2c, 0x40302c,
+            0x40342c, 0x403c2c, 0x40402c, 0x3c402c, 0x34402c, 0x30402c, 0x2c402c, 0x2c4030, 0x2c4034, 0x2c403c, 0x2c4040, 0x2c3c40, 0x2c3440,
+            0x2c3040, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000
+        };
+
+        set_palette(default_palette);
+
+        return true;
+    }
+
+    void run()
+    {
+        if (!on_create())
+        {
+            shutdown();
+            return;
+        }
+
+        platform_show();
+
+        m_active = true;
+        m_frame = 0;
+        m_timer.reset();
+        VgfwProfiler::instance().set_thread_name("main");
+
+        if (!m_profile_dump.empty())
+        {
+            VgfwProfiler::instance().enable(m_profile_events);
+        }
+
+        start_present_thread();
+
+        auto prev_time = VgfwFrameTimer::Clock::now();
+
+        while (m_active)
+        {
+            auto current_time = VgfwFrameTimer::Clock::now();
+            std::chrono::duration<float> elapsed_time = current_time - prev_time;
+            prev_time = current_time;
+            float delta = platform_frame_delta(elapsed_time.count());
+
+            m_timer.begin_frame();
+
+            platform_pump_messages();
+            update_title();
+            m_timer.end_stage(VgfwStage::Messages);
+
+            platform_poll_input();
+
+            if (!process_input(delta))
+            {
+                break;
+            }
+
+            m_timer.end_stage(VgfwStage::Input);
+
+            update_render_size();
+
+            // User update
+            if (!on_update(delta))
+            {
+                quit();
+            }
+
+            m_palette_animation.advance(delta);
+            m_timer.end_stage(VgfwStage::Update);
+
+            // Present
+            if (m_show_overlay)
+            {
+                draw_overlay();
+            }
+
+            submit_frame();
+            ++m_frame;
+            m_timer.end_stage(VgfwStage::Present);
+
+            active_check();
+        }
+
+        stop_present_thread();
+        m_input_record.close();
+        m_input_replay.close();
+        m_hash_record.close();
+        m_hash_compare.close();
+        m_capture.close();
+        on_destroy();
+        dump_timing();
+        dump_profile();
+        shutdown();
+    }
+
+    void quit()
+    {
+        m_quit = true;
+        platform_quit();
+    }
+
+    // Number of frames completed by run() so far
+    uint64_t frame_count() const { return m_frame; }
+
+    // Frame and stage timings for the current run
+    const VgfwFrameTimer& frame_timer() const { return m_timer; }
+
+    // Show frame time percentiles and any counters set with set_overlay_counter() in the top left of each frame
+    void show_overlay(bool show) { m_show_overlay = show; }
+    bool overlay_visible() const { return m_show_overlay; }
+    void set_overlay_colors(uint8_t foreground, uint8_t background) { m_overlay.set_colors(foreground, background); }
+
+    // Add or update a named value shown on the overlay under the frame timings
+    void set_overlay_counter(const char* name, double value)
+    {
+        for (auto& counter : m_overlay_counters)
+        {
+            if (counter.first == name)
+            {
+                counter.second = value;
+                return;
+            }
+        }
+
+        m_overlay_counters.emplace_back(name, value);
+    }
+
+    // Write the frame timing summary to path when run() finishes, as JSON if path ends in .json and CSV otherwise
+    void set_timing_dump(const char* path) { m_timing_dump = path ? path : ""; }
+
+    // Profile run() and write the zones of every thread to path as a Chrome trace when it finishes. Apps add their own zones
+    // with VGFW_PROFILE_ZONE; each thread keeps up to events_per_thread of them.
+    void set_profile_dump(const char* path, size_t events_per_thread = 1 << 18)
+    {
+        m_profile_dump = path ? path : "";
+        m_profile_events = events_per_thread;
+    }
+
+    // Stream every completed frame to a capture file until stop_capture() or the end of run(). Call after initialize(). Frames are
+    // stored at the full screen size, whatever the render scale.
+    // Frames are delta-compressed on a background thread; the app thread only copies each frame into the writer's queue.
+    bool start_capture(const char* path, int queue_depth = 4)
+    {
+        static_assert(Format::indexed, "Captures store 8-bit indexed frames");
+        return m_capture.open(path, full_screen_width, full_screen_height, queue_depth);
+    }
+
+    void stop_capture() { m_capture.close(); }
+    const VgfwCaptureWriter& capture() const { return m_capture; }
+
+    // Pixels (rows screen_pitch bytes apart) and palette of the most recently completed frame
+    const Pixel* front_buffer() const { return m_frames[m_front].pixels; }
+    const uint32_t* front_palette() const { return m_frames[m_front].palette; }
+
+    // Palette that will be used for the frame being drawn, before any palette effects
+    const uint32_t* palette() const { return m_palette; }
+
+    // Threads started by initialize() to run jobs alongside the app thread. Defaults to one less than the number of hardware
+    // threads. Call before initialize().
+    void set_worker_count(int count) { m_worker_count = count; }
+
+    // Thread pool shared by the app and the engine. Lock views on the app thread before handing them to jobs: lock_rect() and
+    // the other drawing calls mark dirty tiles and are not thread safe, but writing disjoint parts of a locked view is.
+    VgfwJobSystem& jobs() { return m_jobs; }
+
+    template <typename Function>
+    void parallel_for(int begin, int end, int grain, const Function& fn)
+    {
+        m_jobs.parallel_for(begin, end, grain, fn);
+    }
+
+    template <typename Function>
+    void parallel_for_tiles(int width, int height, int tile_width, int tile_height, const Function& fn)
+    {
+        m_jobs.parallel_for_tiles(width, height, tile_width, tile_height, fn);
+    }
+
+    // Number of frame buffers in the ring between the app and the present thread, at least 3. Call before initialize().
+    void set_frame_buffer_count(int count) { m_frame_buffer_count = count < 3 ? 3 : count; }
+
+    // Mailbox by default with a window, Fifo when headless so every frame reaches the frame callbacks
+    void set_present_mode(PresentMode mode) { m_present_mode = mode; }
+
+    // Expected time between frames on the display, used to count duplicated frames
+    void set_present_interval(float seconds) { m_present_interval = std::chrono::duration<float>(seconds); }
+
+    // Draw at scale (0 to 1) of the full screen size on each axis from the next frame on, turning dynamic resolution off
+    void set_render_scale(float scale) { m_resolution.configure(0.0f, scale, scale); }
+
+    // Adjust the render scale each frame, between min_scale and max_scale, to keep the Update stage near target_seconds. The
+    // app sees the current size in screen_width and screen_height and should redraw all of it every frame. A target of 0 turns
+    // dynamic resolution off and goes back to max_scale.
+    void set_dynamic_resolution(float target_seconds, float min_scale = 0.5f, float max_scale = 1.0f)
+    {
+        m_resolution.configure(target_seconds, min_scale, max_scale);
+    }
+
+    bool dynamic_resolution() const { return m_resolution.enabled(); }
+    float render_scale() const { return m_resolution.scale(); }
+
+    PresentStats present_stats() const
+    {
+        PresentStats stats;
+        stats.submitted = m_frames_submitted;
+        stats.presented = m_frames_presented.load();
+        stats.dropped = m_frames_dropped.load();
+        stats.duplicated = m_frames_duplicated.load();
+        stats.stalls = m_frame_stalls;
+        return stats;
+    }
+
+    void set_pixel(uint32_t x, uint32_t y, Pixel p)
+    {
+        if (x < screen_width && y < screen_height)
+        {
+            Frame& back = m_frames[m_back];
+            Pixel* backbuffer = back.pixels;
+            int tile = (x / dirty_tile_size) + (y / dirty_tile_size) * m_tiles_x;
+
+            if (!back.dirty[tile])
+            {
+                // First write to this tile this frame. Writing the value that's already there doesn't change anything.
+                if (back.stale[tile])
+                {
+                    restore_tile(back, tile);
+                }
+
+                if (backbuffer[x + y * screen_pitch] == p)
+                {
+                    return;
+                }
+
+                back.dirty[tile] = 1;
+            }
+
+            backbuffer[x + y * screen_pitch] = p;
+        }
+    }
+
+    Pixel get_pixel(uint32_t x, uint32_t y)
+    {
+        Pixel p = 0;
+
+        if (x < screen_width && y < screen_height)
+        {
+            Frame& back = m_frames[m_back];
+            Pixel* backbuffer = back.pixels;
+            int tile = (x / dirty_tile_size) + (y / dirty_tile_size) * m_tiles_x;
+
+            if (back.stale[tile] && !back.dirty[tile])
+            {
+                restore_tile(back, tile);
+            }
+
+            p = backbuffer[x + y * screen_pitch];
+        }
+
+        return p;
+    }
+
+    // Direct access to a rectangle of the back buffer, clipped to the screen. The tiles it covers are marked as changed and
+    // brought up to date, so the view can be read as well as written for the rest of the frame. Pass overwrite when every
+    // pixel of the rectangle will be written, to skip bringing its contents up to date.
+    View lock_rect(int x, int y, int width, int height, bool overwrite = false)
+    {
+        View screen;
+        screen.pixels = m_frames[m_back].pixels;
+        screen.width = screen_width;
+        screen.height = screen_height;
+        screen.pitch = screen_pitch;
+
+        View view = screen.sub_view(x, y, width, height);
+
+        if (!view.empty())
+        {
+            touch_rect(view.left, view.top, view.width, view.height, overwrite);
+        }
+
+        return view;
+    }
+
+    View lock_screen(bool overwrite = false) { return lock_rect(0, 0, screen_width, screen_height, overwrite); }
+
+    // Span and column writes in screen coordinates, clipped once per call
+    void fill_span(int x, int y, int count, Pixel color) { lock_rect(x, y, count, 1, true).fill_span(0, 0, count, color); }
+
+    void copy_span(int x, int y, const Pixel* src, int count)
+    {
+        int skipped = x < 0 ? -x : 0;
+        lock_rect(x, y, count, 1, true).copy_span(0, 0, src + skipped, count - skipped);
+    }
+
+    void fill_column(int x, int y, int count, Pixel color) { lock_rect(x, y, 1, count, true).fill_column(0, 0, count, color); }
+
+    void draw_sprite(const VgfwSprite& sprite, int x, int y, bool flip_x = false)
+    {
+        static_assert(Format::indexed, "Sprites are 8-bit indexed");
+        View view = lock_rect(x, y, sprite.width(), sprite.height());
+        sprite.draw(view, x - view.left, y - view.top, flip_x);
+    }
+
+    void draw_sprite_scaled(const VgfwSprite& sprite, int x, int y, int width, int height, bool flip_x = false)
+    {
+        static_assert(Format::indexed, "Sprites are 8-bit indexed");
+        View view = lock_rect(x, y, width, height);
+        sprite.draw_scaled(view, x - view.left, y - view.top, width, height, flip_x);
+    }
+
+    // Add a key or mouse button event to the input queue. It is applied to m_keys at the start of the next frame. Safe to
+    // call from any thread.
+    void queue_key_event(int key, bool down) { m_input.push(key, down); }
+
+    // Record each frame's delta and input events to path, starting with the next run()
+    bool record_input(const char* path) { return m_input_record.open_write(path); }
+
+    // Replay a log written by record_input() in place of live input and timing, starting with the next run(). The run ends
+    // with the log. If fixed_delta is greater than zero it is used instead of the recorded deltas.
+    bool replay_input(const char* path, float fixed_delta = 0.0f)
+    {
+        m_replay_delta = fixed_delta;
+        return m_input_replay.open_read(path);
+    }
+
+    // Write a hash of every frame's pixels and palette to path, one per line, starting with the next run()
+    bool record_frame_hashes(const char* path) { return m_hash_record.open_write(path); }
+
+    // Check every frame of the next run() against hashes written by record_frame_hashes(). Frames that differ, or that run past
+    // the end of the file, count as mismatches and are written to <mismatch_prefix><frame number>.png if a prefix is given.
+    bool compare_frame_hashes(const char* path, const char* mismatch_prefix = nullptr)
+    {
+        m_hash_mismatch_prefix = mismatch_prefix ? mismatch_prefix : "";
+        m_hash_mismatches = 0;
+        return m_hash_compare.open_read(path);
+    }
+
+    uint64_t frame_hash_mismatches() const { return m_hash_mismatches; }
+
+    // Input events applied to m_keys this frame, in the order they happened
+    const std::vector<VgfwInputEvent>& input_events() const { return m_input_events; }
+
+    // Fraction of the screen's tiles that changed in the most recently completed frame
+    float dirty_fraction() const { return m_dirty_fraction; }
+
+    void set_palette(uint32_t rgbx[256])
+    {
+        for (int p = 0; p < 256; ++p)
+        {
+            m_palette[p] = rgbx[p] & 0xffffff;
+        }
+    }
+
+    void set_palette(uint8_t* palette)
+    {
+        for (int p = 0; p < 256; ++p)
+        {
+            uint32_t r = palette[p * 3];
+            uint32_t g = palette[(p * 3) + 1];
+            uint32_t b = palette[(p * 3) + 2];
+            m_palette[p] = (r << 16) | (g << 8) | b;
+        }
+    }
+
+    // Shade and blend tables for the base palette. They are rebuilt on the first call after the palette or the shade settings
+    // change, so fetch them once per frame rather than keeping the reference across palette changes.
+    const VgfwColorTables& color_tables()
+    {
+        if (!m_color_tables_valid || memcmp(m_color_tables_palette, m_palette, sizeof(m_palette)) != 0)
+        {
+            m_color_tables.build(m_palette, inverse_colormap(), m_shade_levels, m_fog_color);
+            memcpy(m_color_tables_palette, m_palette, sizeof(m_palette));
+            m_color_tables_valid = true;
+        }
+
+        return m_color_tables;
+    }
+
+    // RGB to palette index mapping for the base palette, rebuilt on the first call after the palette changes
+    const VgfwInverseColormap& inverse_colormap()
+    {
+        if (!m_colormap_valid || memcmp(m_colormap_palette, m_palette, sizeof(m_palette)) != 0)
+        {
+            m_colormap.build(m_palette);
+            memcpy(m_colormap_palette, m_palette, sizeof(m_palette));
+            m_colormap_valid = true;
+        }
+
+        return m_colormap;
+    }
+
+    // Number of light levels in the shade table (32 by default) and the color level 0 fades to
+    void set_shade_levels(int levels, uint32_t fog_color = 0)
+    {
+        m_shade_levels = levels;
+        m_fog_color = fog_color;
+        m_color_tables_valid = false;
+    }
+
+    // Palette effects, applied to m_palette as each frame is submitted. palette() stays the base palette the effects start from.
+    void fade_palette(const uint32_t* target, float seconds) { m_palette_animation.fade_to(target, seconds); }
+    void fade_palette_to_base(float seconds) { m_palette_animation.fade_to_base(seconds); }
+    void flash_palette(uint32_t color, float seconds) { m_palette_animation.flash(color, seconds); }
+    void cycle_palette(int first, int count, float period, bool smooth = false) { m_palette_animation.add_cycle(first, count, period, smooth); }
+    void stop_palette_cycles() { m_palette_animation.clear_cycles(); }
+    bool palette_fading() const { return m_palette_animation.fading(); }
+
+    // Expand count palette indices from src into 0x00rrggbb pixels in dst. This is the conversion the presentation step
+    // uses for the front buffer each frame.
+    static void expand_palette(const uint8_t* src, uint32_t* dst, size_t count, const uint32_t* palette)
+    {
+        size_t i = 0;
+
+#if VGFW_AVX2
+        const int* lut = reinterpret_cast<const int*>(palette);
+
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i indices = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m256i lo = _mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(indices), 4);
+            __m256i hi = _mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(_mm_srli_si128(indices, 8)), 4);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), lo);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 8), hi);
+        }
+#elif VGFW_SSE2
+        // No gather before AVX2, so do the lookups from one wide load and write the results four at a time
+        for (; i + 8 <= count; i += 8)
+        {
+            uint64_t indices;
+            memcpy(&indices, src + i, sizeof(indices));
+            __m128i lo = _mm_setr_epi32(palette[indices & 255], palette[(indices >> 8) & 255], palette[(indices >> 16) & 255],
+                                        palette[(indices >> 24) & 255]);
+            __m128i hi = _mm_setr_epi32(palette[(indices >> 32) & 255], palette[(indices >> 40) & 255], palette[(indices >> 48) & 255],
+                                        palette[indices >> 56]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), lo);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), hi);
+        }
+#endif
+
+        for (; i < count; ++i)
+        {
+            dst[i] = palette[src[i]];
+        }
+    }
+
+    // Expand a src_width x src_height block of frame pixels into a dst_width x dst_height block of 0x00rrggbb pixels with
+    // nearest neighbour scaling. Whole number scales up to 4x use kernels specialized for that scale, which write every
+    // destination pixel exactly once; anything else goes through the generic path. Pitches are in pixels.
+    static void expand_palette_scaled(const Pixel* src, int src_pitch, int src_width, int src_height, uint32_t* dst, int dst_pitch,
+                                      int dst_width, int dst_height, const uint32_t* palette)
+    {
+        if (dst_width % src_width == 0 && dst_height % src_height == 0 && dst_width / src_width == dst_height / src_height)
+        {
+            switch (dst_width / src_width)
+            {
+                case 1:
+                {
+                    expand_palette_scaled<1>(src, src_pitch, src_width, src_height, dst, dst_pitch, palette);
+                    return;
+                }
+                case 2:
+                {
+                    expand_palette_scaled<2>(src, src_pitch, src_width, src_height, dst, dst_pitch, palette);
+                    return;
+                }
+                case 3:
+                {
+                    expand_palette_scaled<3>(src, src_pitch, src_width, src_height, dst, dst_pitch, palette);
+                    return;
+                }
+                case 4:
+                {
+                    expand_palette_scaled<4>(src, src_pitch, src_width, src_height, dst, dst_pitch, palette);
+                    return;
+                }
+            }
+        }
+
+        // Generic path, 16.16 fixed point source coordinates sampled at destination pixel centres
+        uint32_t step_x = static_cast<uint32_t>((static_cast<uint64_t>(src_width) << 16) / dst_width);
+        uint32_t step_y = static_cast<uint32_t>((static_cast<uint64_t>(src_height) << 16) / dst_height);
+        uint32_t v = step_y / 2;
+        int prev_sy = -1;
+
+        for (int y = 0; y < dst_height; ++y, v += step_y)
+        {
+            int sy = static_cast<int>(v >> 16);
+            uint32_t* dst_row = dst + y * dst_pitch;
+
+            if (sy == prev_sy)
+            {
+                // Same source row as the line above, copy it rather than doing the lookups again
+                memcpy(dst_row, dst_row - dst_pitch, dst_width * sizeof(uint32_t));
+                continue;
+            }
+
+            const Pixel* src_row = src + sy * src_pitch;
+            uint32_t u = step_x / 2;
+
+            for (int x = 0; x < dst_width; ++x, u += step_x)
+            {
+                dst_row[x] = Format::to_xrgb(src_row[u >> 16], palette);
+            }
+
+            prev_sy = sy;
+        }
+    }
+
+    template <int Scale>
+    static void expand_palette_scaled(const Pixel* src, int src_pitch, int src_width, int src_height, uint32_t* dst, int dst_pitch,
+                                      const uint32_t* palette)
+    {
+        for (int y = 0; y < src_height; ++y)
+        {
+            uint32_t* dst_row = dst + y * Scale * dst_pitch;
+            expand_row_scaled(src + y * src_pitch, dst_row, src_width, palette, std::integral_constant<int, Scale>());
+
+            for (int i = 1; i < Scale; ++i)
+            {
+                memcpy(dst_row + i * dst_pitch, dst_row, src_width * Scale * sizeof(uint32_t));
+            }
+        }
+    }
+
+    void clear_screen(Pixel c)
+    {
+        Frame& back = m_frames[m_back];
+        back.surface.fill(c);
+
+        // Every tile is overwritten, so nothing needs restoring first
+        std::fill(back.dirty.begin(), back.dirty.end(), 1);
+        std::fill(back.stale.begin(), back.stale.end(), 0);
+    }
+
+    // Clear the screen to color and depth to depth_value in one pass over bands of rows, with streaming stores, split across
+    // the job system if parallel is set. Only the first screen_height rows of each are cleared. Each call is timed as the Clear
+    // stage of the frame timer.
+    void clear_screen_and_depth(Pixel color, VgfwSurface<float>& depth, float depth_value, bool parallel = true)
+    {
+        VGFW_PROFILE_ZONE("clear_screen_and_depth");
+        VgfwFrameTimer::Clock::time_point start = VgfwFrameTimer::Clock::now();
+        Frame& back = m_frames[m_back];
+        int rows = screen_height;
+
+        auto clear_rows = [&](int first, int last) {
+            back.surface.stream_fill(color, first < screen_height ? first : screen_height, last < screen_height ? last : screen_height);
+            depth.stream_fill(depth_value, first < depth.height() ? first : depth.height(), last < depth.height() ? last : depth.height());
+        };
+
+        if (parallel)
+        {
+            m_jobs.parallel_for(0, rows, 16, clear_rows);
+        }
+        else
+        {
+            clear_rows(0, rows);
+        }
+
+        std::fill(back.dirty.begin(), back.dirty.end(), 1);
+        std::fill(back.stale.begin(), back.stale.end(), 0);
+        m_timer.record(VgfwStage::Clear, std::chrono::duration<float, std::micro>(VgfwFrameTimer::Clock::now() - start).count());
+    }
+
+    // Draw from (x1, y1) up to but not including (x2, y2). The line is clipped to the screen before any pixels are visited, so
+    // only its visible part costs anything.
+    void draw_line(int x1, int y1, int x2, int y2, Pixel c) { draw_clipped_line(m_frames[m_back], x1, y1, x2, y2, c); }
+
+    // Draw a list of lines, such as the edges of a wireframe mesh
+    void draw_lines(const Line* lines, size_t count)
+    {
+        Frame& back = m_frames[m_back];
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Line& line = lines[i];
+
+            // Skip lines that are entirely off one side of the screen without setting up the stepping
+            if ((line.x1 < 0 && line.x2 < 0) || (line.y1 < 0 && line.y2 < 0) || (line.x1 >= screen_width && line.x2 >= screen_width) ||
+                (line.y1 >= screen_height && line.y2 >= screen_height))
+            {
+                continue;
+            }
+
+            draw_clipped_line(back, line.x1, line.y1, line.x2, line.y2, line.color);
+        }
+    }
+
+#if VGFW_PLATFORM_HEADLESS
+    void set_headless_options(const HeadlessOptions& options) { m_headless = options; }
+#endif
+
+protected:
+    // Drawing marks the dirty_tile_size square tiles it touches, and only those tiles are expanded and copied when the frame
+    // is presented
+    static const int dirty_tile_size = 32;
+
+    struct KeyState
+    {
+        bool pressed;
+        bool released;
+        bool down;
+    };
+
+    KeyState m_keys[256] = {};
+
+private:
+    void update_title()
+    {
+        // Setting the title is a round trip to the window manager, so only do it about once a second
+        auto now = VgfwFrameTimer::Clock::now();
+
+        if (now - m_title_updated >= std::chrono::seconds(1))
+        {
+            platform_set_title_stats(m_timer.percentile(VgfwStage::Frame, 0.5f), m_timer.percentile(VgfwStage::Frame, 0.99f));
+            m_title_updated = now;
+        }
+    }
+
+    void draw_overlay()
+    {
+        // The text only changes a few times a second, in between the cached image is redrawn as is
+        auto now = VgfwFrameTimer::Clock::now();
+
+        if (now - m_overlay_updated >= std::chrono::milliseconds(250))
+        {
+            static const VgfwStage stages[] = { VgfwStage::Frame, VgfwStage::Update, VgfwStage::Clear, VgfwStage::Present };
+            char text[VgfwOverlay::max_columns + 1];
+            int line = 0;
+
+            m_overlay.set_line(line++, "ms         p50     p95     p99     max");
+
+            for (VgfwStage stage : stages)
+            {
+                if (stage == VgfwStage::Clear && m_timer.count(stage) == 0)
+                {
+                    continue;
+                }
+
+                snprintf(text, sizeof(text), "%-8s%8.2f%8.2f%8.2f%8.2f", VgfwFrameTimer::stage_name(stage), m_timer.percentile(stage, 0.5f) * 0.001f,
+                         m_timer.percentile(stage, 0.95f) * 0.001f, m_timer.percentile(stage, 0.99f) * 0.001f, m_timer.window_max(stage) * 0.001f);
+                m_overlay.set_line(line++, text);
+            }
+
+            PresentStats stats = present_stats();
+            snprintf(text, sizeof(text), "frames  %llu dropped %llu dup %llu dirty %d%%", (unsigned long long)stats.presented,
+                     (unsigned long long)stats.dropped, (unsigned long long)stats.duplicated, static_cast<int>(m_dirty_fraction * 100.0f + 0.5f));
+            m_overlay.set_line(line++, text);
+
+            if (screen_width != full_screen_width || screen_height != full_screen_height || m_resolution.enabled())
+            {
+                snprintf(text, sizeof(text), "render  %dx%d (%d%%)", screen_width, screen_height,
+                         static_cast<int>(m_resolution.scale() * 100.0f + 0.5f));
+                m_overlay.set_line(line++, text);
+            }
+
+            for (const auto& counter : m_overlay_counters)
+            {
+                snprintf(text, sizeof(text), "%-16s%.6g", counter.first.c_str(), counter.second);
+                m_overlay.set_line(line++, text);
+            }
+
+            m_overlay.set_line_count(line);
+            m_overlay_updated = now;
+        }
+
+        touch_rect(2, 2, m_overlay.width(), m_overlay.height());
+        draw_overlay_image(std::integral_constant<bool, Format::indexed>());
+    }
+
+    void draw_overlay_image(std::true_type) { m_overlay.draw(m_frames[m_back].pixels, screen_pitch, screen_width, screen_height, 2, 2); }
+
+    // The overlay's colors are palette indices, so true color frames get them through the palette
+    void draw_overlay_image(std::false_type)
+    {
+        Pixel colors[256];
+
+        for (int i = 0; i < 256; ++i)
+        {
+            colors[i] = Format::from_xrgb(m_palette[i]);
+        }
+
+        m_overlay.draw(m_frames[m_back].pixels, screen_pitch, screen_width, screen_height, 2, 2, colors);
+    }
+
+    // Apply the frame's queued events to m_keys. A key that goes down and up again within one frame is reported as both
+    // pressed and released. When replaying, the events and delta come from the log instead, and this returns false once the
+    // log has run out.
+    bool process_input(float& delta)
+    {
+        m_input.drain(m_input_events);
+
+        if (m_input_replay.is_reading())
+        {
+            float recorded_delta;
+
+            if (!m_input_replay.read_frame(recorded_delta, m_input_events))
+            {
+                m_input_replay.close();
+                return false;
+            }
+
+            delta = m_replay_delta > 0.0f ? m_replay_delta : recorded_delta;
+        }
+
+        if (m_input_record.is_writing())
+        {
+            m_input_record.write_frame(delta, m_input_events);
+        }
+
+        for (int i = 0; i < 256; i++)
+        {
+            m_keys[i].pressed = false;
+            m_keys[i].released = false;
+        }
+
+        for (const VgfwInputEvent& event : m_input_events)
+        {
+            KeyState& key = m_keys[event.key];
+
+            if (event.down && !key.down)
+            {
+                key.pressed = true;
+                key.down = true;
+            }
+            else if (!event.down && key.down)
+            {
+                key.released = true;
+                key.down = false;
+            }
+        }
+
+        return true;
+    }
+
+    void dump_timing()
+    {
+        if (m_timing_dump.empty())
+        {
+            return;
+        }
+
+        size_t n = m_timing_dump.size();
+
+        if (n >= 5 && m_timing_dump.compare(n - 5, 5, ".json") == 0)
+        {
+            m_timer.write_json(m_timing_dump.c_str());
+        }
+        else
+        {
+            m_timer.write_csv(m_timing_dump.c_str());
+        }
+    }
+
+    void dump_profile()
+    {
+        if (m_profile_dump.empty())
+        {
+            return;
+        }
+
+        VgfwProfiler::instance().disable();
+        VgfwProfiler::instance().write_chrome_trace(m_profile_dump.c_str());
+    }
+
+    // Row kernels for expand_palette_scaled, picked by overload on the scale. The SIMD ones take 8-bit palette indices.
+    template <int Scale>
+    static void expand_row_scaled(const Pixel* src, uint32_t* dst, int width, const uint32_t* palette, std::integral_constant<int, Scale>)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            uint32_t c = Format::to_xrgb(src[x], palette);
+
+            for (int i = 0; i < Scale; ++i)
+            {
+                dst[i] = c;
+            }
+
+            dst += Scale;
+        }
+    }
+
+    static void expand_row_scaled(const uint8_t* src, uint32_t* dst, int width, const uint32_t* palette, std::integral_constant<int, 1>)
+    {
+        expand_palette(src, dst, width, palette);
+    }
+
+#if VGFW_SSE2
+    static void expand_row_scaled(const uint8_t* src, uint32_t* dst, int width, const uint32_t* palette, std::integral_constant<int, 2>)
+    {
+        int x = 0;
+
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i c = _mm_setr_epi32(palette[src[x]], palette[src[x + 1]], palette[src[x + 2]], palette[src[x + 3]]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2), _mm_unpacklo_epi32(c, c));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2 + 4), _mm_unpackhi_epi32(c, c));
+        }
+
+        for (; x < width; ++x)
+        {
+            dst[x * 2] = dst[x * 2 + 1] = palette[src[x]];
+        }
+    }
+
+    static void expand_row_scaled(const uint8_t* src, uint32_t* dst, int width, const uint32_t* palette, std::integral_constant<int, 4>)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_set1_epi32(palette[src[x]]));
+        }
+    }
+#endif
+
+    //===============================================================================================================================================
+    //
+    // Frame ring and present thread
+    //
+    //===============================================================================================================================================
+
+    // A frame buffer and the palette it was finished with. Each one is owned by exactly one of: the app (m_back), the ready
+    // ring, the present thread, or the free ring.
+    //
+    // dirty marks the tiles drawn to while the buffer was last the back buffer. stale marks tiles that other frames have
+    // changed since then, which only the app thread uses. Stale tiles are brought up to date from the front buffer the first
+    // time they're touched, or when the frame is submitted, so a finished frame is always complete.
+    struct Frame
+    {
+        VgfwSurface<Pixel> surface;
+        Pixel* pixels = nullptr;
+        uint32_t palette[256];
+        uint64_t number = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> dirty;
+        std::vector<uint8_t> stale;
+    };
+
+    // Bresenham from (x1, y1) up to but not including (x2, y2), with the first and last visible steps solved for up front rather
+    // than tested per pixel. Step i of n along the major axis moves floor((2 * i * minor + n) / (2 * n)) along the minor axis,
+    // which matches the usual error term walk exactly. Coordinates are clamped to +/-2^30 to keep that product in 64 bits.
+    void draw_clipped_line(Frame& back, int x1, int y1, int x2, int y2, Pixel c)
+    {
+        const int64_t limit = 1 << 30;
+
+        // (std::min) and (std::max) are parenthesized so Windows.h's min and max macros can't expand them
+        int64_t ax = (std::max)(-limit, (std::min)(static_cast<int64_t>(x1), limit));
+        int64_t ay = (std::max)(-limit, (std::min)(static_cast<int64_t>(y1), limit));
+        int64_t bx = (std::max)(-limit, (std::min)(static_cast<int64_t>(x2), limit));
+        int64_t by = (std::max)(-limit, (std::min)(static_cast<int64_t>(y2), limit));
+        int step_x = bx > ax ? 1 : (bx < ax ? -1 : 0);
+        int step_y = by > ay ? 1 : (by < ay ? -1 : 0);
+        int64_t delta_x = (bx - ax) * step_x;
+        int64_t delta_y = (by - ay) * step_y;
+        int pitch = screen_pitch;
+
+        if (delta_y == 0)
+        {
+            // Horizontal, including the start point when x1 == x2 (which draws nothing)
+            int64_t left = step_x > 0 ? ax : bx + 1;
+            int64_t right = step_x > 0 ? bx : ax + 1;
+            left = left > 0 ? left : 0;
+            right = right < screen_width ? right : screen_width;
+
+            if (ay >= 0 && ay < screen_height && left < right)
+            {
+                int count = static_cast<int>(right - left);
+                touch_rect(static_cast<int>(left), static_cast<int>(ay), count, 1, true);
+                Pixel* p = back.pixels + ay * pitch + left;
+                std::fill(p, p + count, c);
+            }
+
+            return;
+        }
+
+        if (delta_x == 0)
+        {
+            int64_t top = step_y > 0 ? ay : by + 1;
+            int64_t bottom = step_y > 0 ? by : ay + 1;
+            top = top > 0 ? top : 0;
+            bottom = bottom < screen_height ? bottom : screen_height;
+
+            if (ax >= 0 && ax < screen_width && top < bottom)
+            {
+                touch_rect(static_cast<int>(ax), static_cast<int>(top), 1, static_cast<int>(bottom - top), true);
+                Pixel* p = back.pixels + top * pitch + ax;
+
+                for (int64_t y = top; y < bottom; ++y, p += pitch)
+                {
+                    *p = c;
+                }
+            }
+
+            return;
+        }
+
+        // Express the line as steps along its major axis (x when strictly wider than tall, as the per-pixel version did)
+        bool x_major = delta_x > delta_y;
+        int64_t major_start = x_major ? ax : ay;
+        int64_t minor_start = x_major ? ay : ax;
+        int64_t major_size = x_major ? screen_width : screen_height;
+        int64_t minor_size = x_major ? screen_height : screen_width;
+        int major_dir = x_major ? step_x : step_y;
+        int minor_dir = x_major ? step_y : step_x;
+        int64_t n = x_major ? delta_x : delta_y;
+        int64_t minor = x_major ? delta_y : delta_x;
+
+        auto minor_steps = [&](int64_t i) { return (2 * i * minor + n) / (2 * n); };
+
+        // Steps that keep the major coordinate on screen
+        int64_t first = major_dir > 0 ? -major_start : major_start - major_size + 1;
+        int64_t last = major_dir > 0 ? major_size - major_start : major_start + 1;
+        first = first > 0 ? first : 0;
+        last = last < n ? last : n;
+
+        if (first >= last)
+        {
+            return;
+        }
+
+        // The minor coordinate is monotonic in the step, so binary search for the steps where it enters and leaves the screen
+        int64_t enter = minor_dir > 0 ? -minor_start : minor_start - minor_size + 1;
+        int64_t leave = minor_dir > 0 ? minor_size - minor_start : minor_start + 1;
+
+        auto first_step_reaching = [&](int64_t target) {
+            int64_t lo = first;
+            int64_t hi = last;
+
+            while (lo < hi)
+            {
+                int64_t mid = lo + (hi - lo) / 2;
+
+                if (minor_steps(mid) >= target)
+                {
+                    hi = mid;
+                }
+                else
+                {
+                    lo = mid + 1;
+                }
+            }
+
+            return lo;
+        };
+
+        first = first_step_reaching(enter);
+        last = first_step_reaching(leave);
+
+        if (first >= last)
+        {
+            return;
+        }
+
+        int64_t taken = minor_steps(first);
+        int x = static_cast<int>(x_major ? ax + step_x * first : ax + step_x * taken);
+        int y = static_cast<int>(x_major ? ay + step_y * taken : ay + step_y * first);
+        int64_t error = first * minor - taken * n;
+
+        Pixel* p = back.pixels + y * pitch + x;
+        int major_step = x_major ? step_x : step_y * pitch;
+        int minor_step = x_major ? step_y * pitch : step_x;
+        int major_x = x_major ? step_x : 0;
+        int major_y = x_major ? 0 : step_y;
+
+        for (int64_t i = first; i < last; ++i)
+        {
+            int tile = (x / dirty_tile_size) + (y / dirty_tile_size) * m_tiles_x;
+
+            if (!back.dirty[tile])
+            {
+                touch_tile(back, tile);
+            }
+
+            *p = c;
+            p += major_step;
+            x += major_x;
+            y += major_y;
+            error += minor;
+
+            if (error * 2 >= n)
+            {
+                p += minor_step;
+                x += step_x - major_x;
+                y += step_y - major_y;
+                error -= n;
+            }
+        }
+    }
+
+    // Mark a tile as changed this frame, restoring it first if it's out of date
+    void touch_tile(Frame& back, int tile)
+    {
+        if (back.stale[tile])
+        {
+            restore_tile(back, tile);
+        }
+
+        back.dirty[tile] = 1;
+    }
+
+    void restore_tile(Frame& back, int tile)
+    {
+        const Pixel* src = m_frames[m_front].pixels;
+        int x = (tile % m_tiles_x) * dirty_tile_size;
+        int y = (tile / m_tiles_x) * dirty_tile_size;
+        int w = full_screen_width - x < dirty_tile_size ? full_screen_width - x : dirty_tile_size;
+        int h = full_screen_height - y < dirty_tile_size ? full_screen_height - y : dirty_tile_size;
+
+        for (int row = y; row < y + h; ++row)
+        {
+            memcpy(back.pixels + row * screen_pitch + x, src + row * screen_pitch + x, w * sizeof(Pixel));
+        }
+
+        back.stale[tile] = 0;
+    }
+
+    // Mark the tiles covering a rectangle of the back buffer as dirty, restoring any stale ones first. With overwrite set,
+    // stale tiles that lie entirely inside the rectangle are not restored, as the caller is about to write all of it.
+    void touch_rect(int x, int y, int width, int height, bool overwrite = false)
+    {
+        int left = (std::max)(x, 0);
+        int top = (std::max)(y, 0);
+        int right = (std::min)(x + width, screen_width);
+        int bottom = (std::min)(y + height, screen_height);
+
+        if (right <= left || bottom <= top)
+        {
+            return;
+        }
+
+        Frame& back = m_frames[m_back];
+
+        for (int ty = top / dirty_tile_size; ty <= (bottom - 1) / dirty_tile_size; ++ty)
+        {
+            for (int tx = left / dirty_tile_size; tx <= (right - 1) / dirty_tile_size; ++tx)
+            {
+                int tile = tx + ty * m_tiles_x;
+
+                if (!back.dirty[tile])
+                {
+                    if (back.stale[tile])
+                    {
+                        int tile_x = tx * dirty_tile_size;
+                        int tile_y = ty * dirty_tile_size;
+                        bool covered = overwrite && tile_x >= left && tile_y >= top && (std::min)(tile_x + dirty_tile_size, screen_width) <= right &&
+                                       (std::min)(tile_y + dirty_tile_size, screen_height) <= bottom;
+
+                        if (covered)
+                        {
+                            back.stale[tile] = 0;
+                        }
+                        else
+                        {
+                            restore_tile(back, tile);
+                        }
+                    }
+
+                    back.dirty[tile] = 1;
+                }
+            }
+        }
+    }
+
+    void start_present_thread()
+    {
+        int count = static_cast<int>(m_frames.size());
+        m_ready_frames.reset(count);
+        m_free_frames.reset(count);
+
+        for (int i = 1; i < count; ++i)
+        {
+            m_free_frames.push(i);
+        }
+
+        m_back = 0;
+        m_front = 0;
+        m_frames_submitted = 0;
+        m_frame_stalls = 0;
+        m_frames_presented = 0;
+        m_frames_dropped = 0;
+        m_frames_duplicated = 0;
+        m_present_stop = false;
+        m_present_valid = false;
+        m_present_thread = std::thread(&BasicVgfw::present_thread, this);
+    }
+
+    void stop_present_thread()
+    {
+        if (m_present_thread.joinable())
+        {
+            m_present_stop = true;
+            m_present_signal.notify();
+            m_present_thread.join();
+        }
+    }
+
+    // Set screen_width and screen_height for the coming frame from the render scale, feeding the controller the time the last
+    // frame's update took
+    void update_render_size()
+    {
+        float scale = m_resolution.scale();
+
+        if (m_resolution.enabled() && m_timer.count(VgfwStage::Update) > 0)
+        {
+            scale = m_resolution.update(m_timer.last(VgfwStage::Update) * 1e-6f);
+        }
+
+        int width = static_cast<int>(full_screen_width * scale + 0.5f);
+        int height = static_cast<int>(full_screen_height * scale + 0.5f);
+        screen_width = width < 1 ? 1 : (width > full_screen_width ? full_screen_width : width);
+        screen_height = height < 1 ? 1 : (height > full_screen_height ? full_screen_height : height);
+    }
+
+    // Hand the back buffer to the present thread and take a free one to draw the next frame into
+    void submit_frame()
+    {
+        Frame& frame = m_frames[m_back];
+        m_palette_animation.apply(m_palette, frame.palette);
+        frame.number = m_frame;
+        frame.width = screen_width;
+        frame.height = screen_height;
+
+        // Finish the frame and let the other buffers know which tiles are now out of date
+        int tile_count = m_tiles_x * m_tiles_y;
+        int dirty_count = 0;
+
+        for (int tile = 0; tile < tile_count; ++tile)
+        {
+            if (frame.stale[tile] && !frame.dirty[tile])
+            {
+                restore_tile(frame, tile);
+            }
+
+            dirty_count += frame.dirty[tile];
+        }
+
+        m_dirty_fraction = dirty_count / static_cast<float>(tile_count);
+
+        submit_capture(frame, std::integral_constant<bool, Format::indexed>());
+
+        if (m_hash_record.is_writing() || m_hash_compare.is_reading())
+        {
+            check_frame_hash(frame);
+        }
+
+        for (Frame& other : m_frames)
+        {
+            if (&other != &frame)
+            {
+                for (int tile = 0; tile < tile_count; ++tile)
+                {
+                    other.stale[tile] |= frame.dirty[tile];
+                }
+            }
+        }
+
+        // The ready ring has room for every buffer, so this can't fail
+        m_ready_frames.push(m_back);
+        m_present_signal.notify();
+        m_front = m_back;
+        ++m_frames_submitted;
+
+        if (!m_free_frames.pop(m_back))
+        {
+            VGFW_PROFILE_ZONE("wait_for_buffer");
+            ++m_frame_stalls;
+            m_free_signal.wait([this] { return m_free_frames.pop(m_back); });
+        }
+
+        Frame& back = m_frames[m_back];
+        std::fill(back.dirty.begin(), back.dirty.end(), 0);
+    }
+
+    void present_thread()
+    {
+        int shown = -1;
+        VgfwProfiler::instance().set_thread_name("present");
+
+        for (;;)
+        {
+            bool ready = m_present_signal.wait_for(m_present_interval, [this] { return !m_ready_frames.empty() || m_present_stop || m_repaint; });
+
+            int next = -1;
+
+            if (m_present_mode == PresentMode::Mailbox)
+            {
+                int frame;
+
+                while (m_ready_frames.pop(frame))
+                {
+                    if (next >= 0)
+                    {
+                        // The dropped frame's changes still have to reach the presentation surface
+                        accumulate_dirty(m_frames[next]);
+                        release_frame(next);
+                        ++m_frames_dropped;
+                    }
+
+                    next = frame;
+                }
+            }
+            else
+            {
+                m_ready_frames.pop(next);
+            }
+
+            if (next < 0)
+            {
+                if (m_present_stop)
+                {
+                    break;
+                }
 
-    virtual ~Vgfw() = default;
+                if (m_repaint.exchange(false))
+                {
+                    platform_repaint();
+                }
+                else if (!ready && shown >= 0)
+                {
+                    ++m_frames_duplicated;
+                }
 
-    virtual bool on_create() = 0;
-    virtual void on_destroy() = 0;
-    virtual bool on_update(float delta) = 0;
+                continue;
+            }
 
-    bool initialize(const wchar_t* name, int screen_width_ = 320, int screen_height_ = 240, int window_scale = 2)
-    {
-        m_title = _wcsdup(name);
+            m_repaint = false;
 
-        screen_width = screen_width_;
-        screen_height = screen_height_;
-        window_width = screen_width * window_scale;
-        window_height = screen_height * window_scale;
+            {
+                VGFW_PROFILE_ZONE("present_frame");
+                platform_present_frame(m_frames[next]);
+            }
 
-        // Create window
-        WNDCLASSEXW wc = {};
-        wc.cbSize = sizeof(wc);
-        wc.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
-        wc.lpfnWndProc = window_proc;
-        wc.hInstance = GetModuleHandle(NULL);
-        wc.hCursor = LoadCursor(NULL, IDC_ARROW);
-        wc.lpszClassName = m_classname;
+            ++m_frames_presented;
 
-        if (!RegisterClassEx(&wc))
-        {
-            return false;
-        }
+            if (shown >= 0)
+            {
+                release_frame(shown);
+            }
 
-        DWORD dwExStyle = WS_EX_OVERLAPPEDWINDOW;
-        DWORD dwStyle = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_CLIPSIBLINGS | WS_CLIPCHILDREN;
-        RECT client_rect = { 0, 0, window_width, window_height };
-        AdjustWindowRectEx(&client_rect, dwStyle, FALSE, dwExStyle);
-        int width = client_rect.right - client_rect.left;
-        int height = client_rect.bottom - client_rect.top;
-        m_hwnd = CreateWindowEx(dwExStyle, m_classname, m_title, dwStyle, 0, 0, width, height, NULL, NULL, GetModuleHandle(NULL), NULL);
-        SetProp(m_hwnd, m_classname, (HANDLE)this);
+            shown = next;
+        }
 
-        if (m_hwnd == NULL)
+        if (shown >= 0)
         {
-            return false;
+            release_frame(shown);
         }
+    }
 
-        int x = (GetSystemMetrics(SM_CXSCREEN) - width) / 2;
-        int y = (GetSystemMetrics(SM_CYSCREEN) - height) / 2;
-        SetWindowPos(m_hwnd, 0, x, y, 0, 0, SWP_NOZORDER | SWP_NOSIZE);
-
-        // Initialise key states
-        for (int i = 0; i < 2; ++i)
+    void submit_capture(const Frame& frame, std::true_type)
+    {
+        if (m_capture.is_open())
         {
-            m_keystate[i] = new short[256];
-            memset(m_keystate[i], 0, sizeof(short) * 256);
+            m_capture.submit(frame.number, frame.pixels, screen_pitch, frame.palette);
         }
+    }
 
-        // Initialise frame buffer
-        for (int i = 0; i < 2; ++i)
+    void submit_capture(const Frame&, std::false_type) {}
+
+    void check_frame_hash(const Frame& frame)
+    {
+        uint64_t hash = vgfw_frame_hash(frame.pixels, frame.width, frame.height, screen_pitch, frame.palette);
+
+        if (m_hash_record.is_writing())
         {
-            m_framebuffer[i] = new uint8_t[screen_width * screen_height];
-            memset(m_framebuffer[i], 0, screen_width * screen_height);
+            m_hash_record.write(hash);
         }
 
-        // Set default palette
-        static uint32_t default_palette[256] = {
-            0x000000, 0x0000a8, 0x00a800, 0x00a8a8, 0xa80000, 0xa800a8, 0xa85400, 0xa8a8a8, 0x545454, 0x5454fc, 0x54fc54, 0x54fcfc, 0xfc5454,
-            0xfc54fc, 0xfcfc54, 0xfcfcfc, 0x000000, 0x141414, 0x202020, 0x2c2c2c, 0x383838, 0x444444, 0x505050, 0x606060, 0x707070, 0x808080,
-            0x909090, 0xa0a0a0, 0xb4b4b4, 0xc8c8c8, 0xe0e0e0, 0xfcfcfc, 0x0000fc, 0x4000fc, 0x7c00fc, 0xbc00fc, 0xfc00fc, 0xfc00bc, 0xfc007c,
-            0xfc0040, 0xfc0000, 0xfc4000, 0xfc7c00, 0xfcbc00, 0xfcfc00, 0xbcfc00, 0x7cfc00, 0x40fc00, 0x00fc00, 0x00fc40, 0x00fc7c, 0x00fcbc,
-            0x00fcfc, 0x00bcfc, 0x007cfc, 0x0040fc, 0x7c7cfc, 0x9c7cfc, 0xbc7cfc, 0xdc7cfc, 0xfc7cfc, 0xfc7cdc, 0xfc7cbc, 0xfc7c9c, 0xfc7c7c,
-            0xfc9c7c, 0xfcbc7c, 0xfcdc7c, 0xfcfc7c, 0xdcfc7c, 0xbcfc7c, 0x9cfc7c, 0x7cfc7c, 0x7cfc9c, 0x7cfcbc, 0x7cfcdc, 0x7cfcfc, 0x7cdcfc,
-            0x7cbcfc, 0x7c9cfc, 0xb4b4fc, 0xc4b4fc, 0xd8b4fc, 0xe8b4fc, 0xfcb4fc, 0xfcb4e8, 0xfcb4d8, 0xfcb4c4, 0xfcb4b4, 0xfcc4b4, 0xfcd8b4,
-            0xfce8b4, 0xfcfcb4, 0xe8fcb4, 0xd8fcb4, 0xc4fcb4, 0xb4fcb4, 0xb4fcc4, 0xb4fcd8, 0xb4fce8, 0xb4fcfc, 0xb4e8fc, 0xb4d8fc, 0xb4c4fc,
-            0x000070, 0x1c0070, 0x380070, 0x540070, 0x700070, 0x700054, 0x700038, 0x70001c, 0x700000, 0x701c00, 0x703800, 0x705400, 0x707000,
-            0x547000, 0x387000, 0x1c7000, 0x007000, 0x00701c, 0x007038, 0x007054, 0x007070, 0x005470, 0x003870, 0x001c70, 0x383870, 0x443870,
-            0x543870, 0x603870, 0x703870, 0x703860, 0x703854, 0x703844, 0x703838, 0x704438, 0x705438, 0x706038, 0x707038, 0x607038, 0x547038,
-            0x447038, 0x387038, 0x387044, 0x387054, 0x387060, 0x387070, 0x386070, 0x385470, 0x384470, 0x505070, 0x585070, 0x605070, 0x685070,
-            0x705070, 0x705068, 0x705060, 0x705058, 0x705050, 0x705850, 0x706050, 0x706850, 0x707050, 0x687050, 0x607050, 0x587050, 0x507050,
-            0x507058, 0x507060, 0x507068, 0x507070, 0x506870, 0x506070, 0x505870, 0x000040, 0x100040, 0x200040, 0x300040, 0x400040, 0x400030,
-            0x400020, 0x400010, 0x400000, 0x401000, 0x402000, 0x403000, 0x404000, 0x304000, 0x204000, 0x104000, 0x004000, 0x004010, 0x004020,
-            0x004030, 0x004040, 0x003040, 0x002040, 0x001040, 0x202040, 0x282040, 0x302040, 0x382040, 0x402040, 0x402038, 0x402030, 0x402028,
-            0x402020, 0x402820, 0x403020, 0x403820, 0x404020, 0x384020, 0x304020, 0x284020, 0x204020, 0x204028, 0x204030, 0x204038, 0x204040,
-            0x203840, 0x203040, 0x202840, 0x2c2c40, 0x302c40, 0x342c40, 0x3c2c40, 0x402c40, 0x402c3c, 0x402c34, 0x402c30, 0x402c2c, 0x40302c,
-            0x40342c, 0x403c2c, 0x40402c, 0x3c402c, 0x34402c, 0x30402c, 0x2c402c, 0x2c4030, 0x2c4034, 0x2c403c, 0x2c4040, 0x2c3c40, 0x2c3440,
-            0x2c3040, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000
-        };
+        uint64_t golden;
 
-        set_palette(default_palette);
+        if (m_hash_compare.is_reading() && (!m_hash_compare.read(golden) || golden != hash))
+        {
+            ++m_hash_mismatches;
 
-        return true;
+            if (!m_hash_mismatch_prefix.empty())
+            {
+                std::string path = m_hash_mismatch_prefix + std::to_string(frame.number) + ".png";
+                write_png(path.c_str(), frame, std::integral_constant<bool, Format::indexed>());
+            }
+        }
     }
 
-    void run()
+    void write_png(const char* path, const Frame& frame, std::true_type)
     {
-        if (!on_create())
+        vgfw_write_png(path, frame.pixels, frame.width, frame.height, screen_pitch, frame.palette);
+    }
+
+    void write_png(const char* path, const Frame& frame, std::false_type)
+    {
+        std::vector<uint32_t> rgb(static_cast<size_t>(frame.width) * frame.height);
+
+        for (int y = 0; y < frame.height; ++y)
         {
-            shutdown();
-            return;
+            for (int x = 0; x < frame.width; ++x)
+            {
+                rgb[y * frame.width + x] = Format::to_xrgb(frame.pixels[y * screen_pitch + x], frame.palette);
+            }
         }
 
-        ShowWindow(m_hwnd, SW_SHOW);
-
-        bool active = true;
+        vgfw_write_png_rgb(path, rgb.data(), frame.width, frame.height, frame.width);
+    }
 
-        auto prev_time = std::chrono::system_clock::now();
+    void release_frame(int frame)
+    {
+        m_free_frames.push(frame);
+        m_free_signal.notify();
+    }
 
-        while (active)
+    // Called on the present thread
+    void accumulate_dirty(const Frame& frame)
+    {
+        for (size_t tile = 0; tile < m_present_dirty.size(); ++tile)
         {
-            auto current_time = std::chrono::system_clock::now();
-            std::chrono::duration<float> elapsed_time = current_time - prev_time;
-            prev_time = current_time;
-            float delta = elapsed_time.count();
+            m_present_dirty[tile] |= frame.dirty[tile];
+        }
+    }
 
-            wchar_t title[256];
-            swprintf(title, 256, L"%s - %llu us", m_title, (uint64_t)(delta * 1000000.0f));
-            SetWindowText(m_hwnd, title);
+    // Expand and scale the tiles of a frame that changed since the last present into the presentation surface, and set
+    // m_present_rects to the areas of the window that need updating. Called on the present thread.
+    void present_frame(const Frame& frame)
+    {
+        int scale = window_width / frame.width;
+        bool full = !m_present_valid || memcmp(frame.palette, m_presented_palette, sizeof(m_presented_palette)) != 0 ||
+                    frame.width != m_presented_width || frame.height != m_presented_height || window_width != frame.width * scale ||
+                    window_height != frame.height * scale;
 
-            // Process Windows messages
-            MSG msg;
+        m_present_rects.clear();
 
-            while (PeekMessage(&msg, m_hwnd, 0, 0, PM_REMOVE))
-            {
-                TranslateMessage(&msg);
-                DispatchMessage(&msg);
-            }
+        if (full)
+        {
+            expand_palette_scaled(frame.pixels, screen_pitch, frame.width, frame.height, m_present_bits, m_present_pitch, window_width,
+                                  window_height, frame.palette);
+            m_present_rects.push_back({ 0, 0, window_width, window_height });
+        }
+        else
+        {
+            accumulate_dirty(frame);
 
-            // Update keyboard
-            short* current_keystate = m_keystate[m_current_keystate];
-            short* prev_keystate = m_keystate[m_current_keystate ^ 1];
+            // Work in runs of horizontally adjacent dirty tiles, skipping any outside the area drawn at the current render scale
+            int tiles_x = (frame.width + dirty_tile_size - 1) / dirty_tile_size;
+            int tiles_y = (frame.height + dirty_tile_size - 1) / dirty_tile_size;
 
-            for (int i = 0; i < 256; i++)
+            for (int ty = 0; ty < tiles_y; ++ty)
             {
-                current_keystate[i] = GetAsyncKeyState(i);
-
-                m_keys[i].pressed = false;
-                m_keys[i].released = false;
-
-                if (current_keystate[i] != prev_keystate[i])
+                for (int tx = 0; tx < tiles_x;)
                 {
-                    if (current_keystate[i] & 0x8000)
+                    if (!m_present_dirty[tx + ty * m_tiles_x])
                     {
-                        m_keys[i].pressed = !m_keys[i].down;
-                        m_keys[i].down = true;
+                        ++tx;
+                        continue;
                     }
-                    else
+
+                    int run_start = tx;
+
+                    while (tx < tiles_x && m_present_dirty[tx + ty * m_tiles_x])
                     {
-                        m_keys[i].released = true;
-                        m_keys[i].down = false;
+                        ++tx;
                     }
-                }
-            }
 
-            m_current_keystate ^= 1;
+                    int x = run_start * dirty_tile_size;
+                    int y = ty * dirty_tile_size;
+                    int w = (std::min)(tx * dirty_tile_size, frame.width) - x;
+                    int h = frame.height - y < dirty_tile_size ? frame.height - y : dirty_tile_size;
+                    uint32_t* dst = m_present_bits + (y * m_present_pitch + x) * scale;
 
-            // User update
-            if (!on_update(delta))
-            {
-                quit();
+                    expand_palette_scaled(frame.pixels + y * screen_pitch + x, screen_pitch, w, h, dst, m_present_pitch, w * scale, h * scale,
+                                          frame.palette);
+                    m_present_rects.push_back({ x * scale, y * scale, w * scale, h * scale });
+                }
             }
-
-            // Present
-            m_frontbuffer ^= 1;
-            InvalidateRect(m_hwnd, NULL, FALSE);
-
-            // Check if Window closed
-            active = !!IsWindow(m_hwnd);
         }
 
-        on_destroy();
-        shutdown();
+        std::fill(m_present_dirty.begin(), m_present_dirty.end(), 0);
+        memcpy(m_presented_palette, frame.palette, sizeof(m_presented_palette));
+        m_presented_width = frame.width;
+        m_presented_height = frame.height;
+        m_present_valid = true;
     }
 
-    void quit() { PostQuitMessage(0); }
-
-    void set_pixel(uint32_t x, uint32_t y, uint8_t p)
+    void active_check()
     {
-        if (x < screen_width && y < screen_height)
+        if (m_quit || !platform_is_open())
         {
-            uint8_t* backbuffer = m_framebuffer[m_frontbuffer ^ 1];
-            backbuffer[x + y * screen_width] = p;
+            m_active = false;
         }
     }
 
-    uint8_t get_pixel(uint32_t x, uint32_t y)
+    void shutdown()
     {
-        uint8_t p = 0;
+        m_jobs.stop();
+        platform_shutdown();
 
-        if (x < screen_width && y < screen_height)
+        m_frames.clear();
+    }
+
+#if VGFW_PLATFORM_WIN32
+    //===============================================================================================================================================
+    //
+    // Win32 platform
+    //
+    //===============================================================================================================================================
+    bool platform_initialize()
+    {
+        // Create window
+        WNDCLASSEXW wc = {};
+        wc.cbSize = sizeof(wc);
+        wc.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
+        wc.lpfnWndProc = window_proc;
+        wc.hInstance = GetModuleHandle(NULL);
+        wc.hCursor = LoadCursor(NULL, IDC_ARROW);
+        wc.lpszClassName = m_classname;
+
+        if (!RegisterClassEx(&wc))
         {
-            uint8_t* backbuffer = m_framebuffer[m_frontbuffer ^ 1];
-            p = backbuffer[x + y * screen_width];
+            return false;
         }
 
-        return p;
-    }
+        DWORD dwExStyle = WS_EX_OVERLAPPEDWINDOW;
+        DWORD dwStyle = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_CLIPSIBLINGS | WS_CLIPCHILDREN;
+        RECT client_rect = { 0, 0, window_width, window_height };
+        AdjustWindowRectEx(&client_rect, dwStyle, FALSE, dwExStyle);
+        int width = client_rect.right - client_rect.left;
+        int height = client_rect.bottom - client_rect.top;
+        m_hwnd = CreateWindowEx(dwExStyle, m_classname, m_title.c_str(), dwStyle, 0, 0, width, height, NULL, NULL, GetModuleHandle(NULL), NULL);
 
-    void set_palette(uint32_t rgbx[256])
-    {
-        for (int p = 0; p < 256; ++p)
+        if (m_hwnd == NULL)
         {
-            RGBQUAD entry = {};
-            entry.rgbRed = (rgbx[p] >> 16) & 255;
-            entry.rgbGreen = (rgbx[p] >> 8) & 255;
-            entry.rgbBlue = rgbx[p] & 255;
-            m_palette[p] = entry;
+            return false;
         }
-    }
 
-    void set_palette(uint8_t* palette)
-    {
-        for (int p = 0; p < 256; ++p)
+        SetProp(m_hwnd, m_classname, (HANDLE)this);
+
+        int x = (GetSystemMetrics(SM_CXSCREEN) - width) / 2;
+        int y = (GetSystemMetrics(SM_CYSCREEN) - height) / 2;
+        SetWindowPos(m_hwnd, 0, x, y, 0, 0, SWP_NOZORDER | SWP_NOSIZE);
+
+        // Create the presentation surface, a window sized 32-bit DIB section the front buffer is expanded and scaled into each frame
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+        bmi.bmiHeader.biHeight = -window_height;
+        bmi.bmiHeader.biWidth = window_width;
+        bmi.bmiHeader.biPlanes = 1;
+
+        HDC hDC = GetDC(m_hwnd);
+        m_present_dc = CreateCompatibleDC(hDC);
+        m_present_bitmap = CreateDIBSection(hDC, &bmi, DIB_RGB_COLORS, (void**)&m_present_bits, NULL, 0);
+        ReleaseDC(m_hwnd, hDC);
+
+        if (!m_present_bitmap)
         {
-            RGBQUAD entry = {};
-            entry.rgbRed = palette[p * 3];
-            entry.rgbGreen = palette[(p * 3) + 1];
-            entry.rgbBlue = palette[(p * 3) + 2];
-            m_palette[p] = entry;
+            return false;
         }
+
+        m_present_pitch = window_width;
+
+        m_present_old_bitmap = (HBITMAP)SelectObject(m_present_dc, m_present_bitmap);
+
+        return true;
     }
 
-    void clear_screen(uint8_t c)
+    void platform_show() { ShowWindow(m_hwnd, SW_SHOW); }
+
+    float platform_frame_delta(float elapsed) { return elapsed; }
+
+    void platform_set_title_stats(float p50, float p99)
     {
-        uint8_t* backbuffer = m_framebuffer[m_frontbuffer ^ 1];
-        memset(backbuffer, c, screen_width * screen_height);
+        wchar_t title[256];
+        swprintf(title, 256, L"%s - p50 %llu us, p99 %llu us", m_title.c_str(), (uint64_t)p50, (uint64_t)p99);
+        SetWindowText(m_hwnd, title);
     }
 
-    void draw_line(int x1, int y1, int x2, int y2, uint8_t c)
+    void platform_pump_messages()
     {
-        int delta_x = x2 - x1;
-        int delta_y = y2 - y1;
-        int step_x = delta_x > 0 ? 1 : (delta_x < 0 ? -1 : 0);
-        int step_y = delta_y > 0 ? 1 : (delta_y < 0 ? -1 : 0);
+        // Process Windows messages
+        MSG msg;
 
-        if ((delta_x * step_x) > (delta_y * step_y))
+        while (PeekMessage(&msg, m_hwnd, 0, 0, PM_REMOVE))
         {
-            // x-major
-            int y = y1;
-            int error = 0;
-
-            for (int x = x1; x != x2; x += step_x)
-            {
-                set_pixel(x, y, c);
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
 
-                error += step_y * delta_y;
+    // Key and mouse button messages are queued by window_proc as they are dispatched
+    void platform_poll_input() {}
 
-                if ((error * 2) >= step_x * delta_x)
-                {
-                    y += step_y;
-                    error -= step_x * delta_x;
-                }
+    // Release anything held when the window loses focus, as the matching up messages will go elsewhere
+    void release_all_keys()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            if (m_keys[i].down)
+            {
+                m_input.push(i, false);
             }
         }
-        else
-        {
-            // y-major
-            int x = x1;
-            int error = 0;
+    }
 
-            for (int y = y1; y != y2; y += step_y)
-            {
-                set_pixel(x, y, c);
+    // Called on the present thread
+    void platform_present_frame(const Frame& frame)
+    {
+        // Make sure GDI has finished with the DIB before writing to it
+        GdiFlush();
+        present_frame(frame);
 
-                error += step_x * delta_x;
+        HDC hDC = GetDC(m_hwnd);
 
-                if ((error * 2) >= step_y * delta_y)
-                {
-                    x += step_x;
-                    error -= step_y * delta_y;
-                }
+        if (hDC)
+        {
+            for (const VgfwRect& rect : m_present_rects)
+            {
+                BitBlt(hDC, rect.x, rect.y, rect.width, rect.height, m_present_dc, rect.x, rect.y, SRCCOPY);
             }
+
+            ReleaseDC(m_hwnd, hDC);
         }
     }
 
-protected:
-    struct KeyState
+    // Called on the present thread
+    void platform_repaint()
     {
-        bool pressed;
-        bool released;
-        bool down;
-    };
+        HDC hDC = GetDC(m_hwnd);
 
-    KeyState m_keys[256] = {};
+        if (hDC)
+        {
+            BitBlt(hDC, 0, 0, window_width, window_height, m_present_dc, 0, 0, SRCCOPY);
+            ReleaseDC(m_hwnd, hDC);
+        }
+    }
 
-private:
-    void shutdown()
+    bool platform_is_open() { return !!IsWindow(m_hwnd); }
+
+    void platform_quit() { PostQuitMessage(0); }
+
+    void platform_shutdown()
     {
-        for (int i = 0; i < 2; ++i)
+        if (m_present_dc)
         {
-            delete[] m_framebuffer[i];
+            SelectObject(m_present_dc, m_present_old_bitmap);
+            DeleteObject(m_present_bitmap);
+            DeleteDC(m_present_dc);
+            m_present_dc = NULL;
+            m_present_bitmap = NULL;
+            m_present_bits = nullptr;
         }
 
-        for (int i = 0; i < 2; ++i)
+        if (IsWindow(m_hwnd))
         {
-            delete[] m_keystate[i];
+            DestroyWindow(m_hwnd);
         }
 
         UnregisterClass(m_classname, GetModuleHandle(NULL));
-
-        free(m_title);
     }
 
     LRESULT on_paint()
     {
+        // The present thread owns the presentation surface, so just validate the window and ask it to blit again
         PAINTSTRUCT ps = {};
-        HDC hDC = BeginPaint(m_hwnd, &ps);
-
-        char bmi_memory[sizeof(BITMAPINFO) + 256 * sizeof(RGBQUAD)];
-        BITMAPINFO* bmi = (BITMAPINFO*)bmi_memory;
-        ZeroMemory(bmi, sizeof(BITMAPINFO));
-        bmi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-        bmi->bmiHeader.biBitCount = 8;
-        bmi->bmiHeader.biHeight = -screen_height;
-        bmi->bmiHeader.biWidth = screen_width;
-        bmi->bmiHeader.biPlanes = 1;
-        memcpy(bmi->bmiColors, m_palette, 256 * sizeof(RGBQUAD));
-
-        HDC hMemDC = CreateCompatibleDC(hDC);
-        HBITMAP hBitmap = CreateDIBSection(hMemDC, bmi, DIB_RGB_COLORS, NULL, NULL, 0);
-        SetDIBits(hDC, hBitmap, 0, screen_height, m_framebuffer[m_frontbuffer], bmi, DIB_RGB_COLORS);
-
-        HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemDC, hBitmap);
-        StretchBlt(hDC, 0, 0, window_width, window_height, hMemDC, 0, 0, screen_width, screen_height, SRCCOPY);
-
-        SelectObject(hMemDC, hBitmap);
-        DeleteObject(hBitmap);
-        DeleteDC(hMemDC);
-
+        BeginPaint(m_hwnd, &ps);
         EndPaint(m_hwnd, &ps);
 
+        m_repaint = true;
+        m_present_signal.notify();
+
         return (LRESULT)0;
     }
 
     static LRESULT CALLBACK window_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
     {
-        Vgfw* vgfw = (Vgfw*)GetProp(hwnd, L"Vgfw");
+        BasicVgfw* vgfw = (BasicVgfw*)GetProp(hwnd, L"Vgfw");
+
+        if (!vgfw)
+        {
+            return DefWindowProc(hwnd, msg, wparam, lparam);
+        }
 
         switch (msg)
         {
@@ -352,6 +4912,41 @@ private:
             {
                 return vgfw->on_paint();
             }
+            case WM_KEYDOWN:
+            case WM_SYSKEYDOWN:
+            {
+                vgfw->m_input.push(static_cast<int>(wparam), true);
+                break;
+            }
+            case WM_KEYUP:
+            case WM_SYSKEYUP:
+            {
+                vgfw->m_input.push(static_cast<int>(wparam), false);
+                break;
+            }
+            case WM_LBUTTONDOWN:
+            case WM_LBUTTONUP:
+            {
+                vgfw->m_input.push(VK_LBUTTON, msg == WM_LBUTTONDOWN);
+                break;
+            }
+            case WM_RBUTTONDOWN:
+            case WM_RBUTTONUP:
+            {
+                vgfw->m_input.push(VK_RBUTTON, msg == WM_RBUTTONDOWN);
+                break;
+            }
+            case WM_MBUTTONDOWN:
+            case WM_MBUTTONUP:
+            {
+                vgfw->m_input.push(VK_MBUTTON, msg == WM_MBUTTONDOWN);
+                break;
+            }
+            case WM_KILLFOCUS:
+            {
+                vgfw->release_all_keys();
+                break;
+            }
         }
 
         return DefWindowProc(hwnd, msg, wparam, lparam);
@@ -360,10 +4955,139 @@ private:
     const wchar_t* m_classname = L"Vgfw";
 
     HWND m_hwnd = NULL;
-    short* m_keystate[2] = {};
-    int m_current_keystate = 0;
-    uint8_t* m_framebuffer[2] = {};
-    int m_frontbuffer = 0;
-    wchar_t* m_title = nullptr;
-    RGBQUAD m_palette[256] = {};
+    HDC m_present_dc = NULL;
+    HBITMAP m_present_bitmap = NULL;
+    HBITMAP m_present_old_bitmap = NULL;
+#else
+    //===============================================================================================================================================
+    //
+    // Headless platform
+    //
+    //===============================================================================================================================================
+    bool platform_initialize()
+    {
+        m_present_surface.allocate(window_width, window_height);
+        m_present_bits = m_present_surface.data();
+        m_present_pitch = m_present_surface.pitch();
+        return true;
+    }
+
+    void platform_show() {}
+
+    float platform_frame_delta(float) { return m_headless.fixed_delta; }
+
+    void platform_set_title_stats(float, float) {}
+
+    void platform_pump_messages() {}
+
+    void platform_poll_input()
+    {
+        if (m_headless.on_input)
+        {
+            m_headless.on_input(static_cast<int>(m_frame));
+        }
+    }
+
+    // Called on the present thread
+    void platform_present_frame(const Frame& frame)
+    {
+        if (m_headless.on_frame)
+        {
+            m_headless.on_frame(static_cast<int>(frame.number), frame.pixels, screen_pitch, frame.palette);
+        }
+
+        if (m_headless.on_present)
+        {
+            present_frame(frame);
+            m_headless.on_present(static_cast<int>(frame.number), m_present_bits, m_present_pitch);
+        }
+    }
+
+    void platform_repaint() {}
+
+    bool platform_is_open() { return m_frame < static_cast<uint64_t>(m_headless.frame_count); }
+
+    void platform_quit() {}
+
+    void platform_shutdown()
+    {
+        m_present_surface.release();
+        m_present_bits = nullptr;
+    }
+
+    HeadlessOptions m_headless;
+    VgfwSurface<uint32_t> m_present_surface;
+#endif
+
+    std::vector<Frame> m_frames;
+    int m_frame_buffer_count = 3;
+    int m_worker_count = -1;
+    VgfwJobSystem m_jobs;
+    int m_back = 0;
+    int m_front = 0;
+    VgfwSpscRing<int> m_ready_frames;
+    VgfwSpscRing<int> m_free_frames;
+    VgfwSignal m_present_signal;
+    VgfwSignal m_free_signal;
+    std::thread m_present_thread;
+    std::atomic<bool> m_present_stop{ false };
+    std::atomic<bool> m_repaint{ false };
+#if VGFW_PLATFORM_WIN32
+    PresentMode m_present_mode = PresentMode::Mailbox;
+#else
+    PresentMode m_present_mode = PresentMode::Fifo;
+#endif
+    std::chrono::duration<float> m_present_interval{ 1.0f / 60.0f };
+    uint64_t m_frames_submitted = 0;
+    uint64_t m_frame_stalls = 0;
+    std::atomic<uint64_t> m_frames_presented{ 0 };
+    std::atomic<uint64_t> m_frames_dropped{ 0 };
+    std::atomic<uint64_t> m_frames_duplicated{ 0 };
+    int m_tiles_x = 0;
+    int m_tiles_y = 0;
+    float m_dirty_fraction = 0.0f;
+    uint32_t* m_present_bits = nullptr;
+    int m_present_pitch = 0;
+    std::vector<uint8_t> m_present_dirty;
+    std::vector<VgfwRect> m_present_rects;
+    uint32_t m_presented_palette[256] = {};
+    int m_presented_width = 0;
+    int m_presented_height = 0;
+    bool m_present_valid = false;
+    std::wstring m_title;
+    VgfwInputQueue m_input;
+    std::vector<VgfwInputEvent> m_input_events;
+    VgfwInputLog m_input_record;
+    VgfwInputLog m_input_replay;
+    VgfwFrameHashLog m_hash_record;
+    VgfwFrameHashLog m_hash_compare;
+    std::string m_hash_mismatch_prefix;
+    uint64_t m_hash_mismatches = 0;
+    VgfwCaptureWriter m_capture;
+    float m_replay_delta = 0.0f;
+    uint32_t m_palette[256] = {};
+    VgfwPaletteAnimation m_palette_animation;
+    VgfwInverseColormap m_colormap;
+    uint32_t m_colormap_palette[256];
+    bool m_colormap_valid = false;
+    VgfwColorTables m_color_tables;
+    uint32_t m_color_tables_palette[256];
+    bool m_color_tables_valid = false;
+    int m_shade_levels = 32;
+    uint32_t m_fog_color = 0;
+    uint64_t m_frame = 0;
+    VgfwFrameTimer m_timer;
+    VgfwResolutionController m_resolution;
+    std::string m_timing_dump;
+    std::string m_profile_dump;
+    size_t m_profile_events = 0;
+    VgfwOverlay m_overlay;
+    std::vector<std::pair<std::string, double>> m_overlay_counters;
+    bool m_show_overlay = false;
+    VgfwFrameTimer::Clock::time_point m_overlay_updated;
+    VgfwFrameTimer::Clock::time_point m_title_updated;
+    bool m_active = false;
+    bool m_quit = false;
 };
+
+typedef BasicVgfw<VgfwIndexed8> Vgfw;
@@ -0,0 +1,409 @@
+#include "vgfw_bench.h"
+
+#include <climits>
+
+// Runs the demos headless for a fixed number of frames, with fixed deltas and scripted input, and writes the frame and update
+// times of each scene as JSON. Given a baseline written by an earlier run, flags scenes whose times grew by more than a noise
+// threshold and exits with a failure. Link with test.cpp, 3d.cpp and firstpersonshooter.cpp built with VGFW_NO_MAIN, and run
+// from the directory holding the demos' models and textures.
+
+bool bench_test(VgfwBenchScene scene, VgfwFrameTimer& timer);
+bool bench_3d(VgfwBenchScene scene, VgfwFrameTimer& timer);
+bool bench_fps(VgfwBenchScene scene, VgfwFrameTimer& timer);
+
+struct SceneEntry
+{
+    const char* name;
+    bool (*run)(VgfwBenchScene scene, VgfwFrameTimer& timer);
+};
+
+static const SceneEntry scene_entries[] = { { "test", bench_test }, { "3d", bench_3d }, { "fps", bench_fps } };
+
+// Times of one stage in microseconds. Percentiles are over the timer's rolling window, which holds every frame of runs up to
+// VgfwFrameTimer::window_size frames long.
+struct StageStats
+{
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+struct SceneStats
+{
+    std::string name;
+    uint64_t frames = 0;
+    StageStats frame;
+    StageStats update;
+};
+
+static StageStats stage_stats(const VgfwFrameTimer& timer, VgfwStage stage)
+{
+    StageStats stats;
+    stats.mean = timer.session_mean(stage);
+    stats.p50 = timer.percentile(stage, 0.5f);
+    stats.p95 = timer.percentile(stage, 0.95f);
+    stats.p99 = timer.percentile(stage, 0.99f);
+    stats.max = timer.session_max(stage);
+    return stats;
+}
+
+static void write_stage(FILE* file, const char* name, const StageStats& stats, bool last)
+{
+    fprintf(file, "      \"%s\": { \"mean_us\": %.2f, \"p50_us\": %.2f, \"p95_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f }%s\n", name,
+            stats.mean, stats.p50, stats.p95, stats.p99, stats.max, last ? "" : ",");
+}
+
+static bool write_json(const char* path, const std::vector<SceneStats>& scenes)
+{
+    FILE* file = fopen(path, "w");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    fprintf(file, "{\n  \"scenes\": {\n");
+
+    for (size_t i = 0; i < scenes.size(); ++i)
+    {
+        fprintf(file, "    \"%s\": {\n      \"frames\": %llu,\n", scenes[i].name.c_str(), (unsigned long long)scenes[i].frames);
+        write_stage(file, "frame", scenes[i].frame, false);
+        write_stage(file, "update", scenes[i].update, true);
+        fprintf(file, "    }%s\n", i + 1 < scenes.size() ? "," : "");
+    }
+
+    fprintf(file, "  }\n}\n");
+    return fclose(file) == 0;
+}
+
+// Value of "key": after from, or 0 if it isn't there. Only needs to read back what write_json() writes.
+static double find_number(const char* from, const char* key)
+{
+    std::string quoted = std::string("\"") + key + "\":";
+    const char* found = strstr(from, quoted.c_str());
+    return found ? strtod(found + quoted.size(), nullptr) : 0.0;
+}
+
+static bool read_json(const char* path, std::vector<SceneStats>& scenes)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    std::string text;
+    char buffer[4096];
+    size_t read;
+
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        text.append(buffer, read);
+    }
+
+    fclose(file);
+
+    // Each scene is a name followed by its stats object, which holds no further nested names
+    const char* scene = strstr(text.c_str(), "\"scenes\"");
+
+    while (scene && (scene = strstr(scene + 1, "\n    \"")) != nullptr)
+    {
+        const char* name = scene + 6;
+        const char* name_end = strchr(name, '"');
+
+        if (!name_end)
+        {
+            break;
+        }
+
+        SceneStats stats;
+        stats.name.assign(name, name_end);
+        stats.frames = static_cast<uint64_t>(find_number(name_end, "frames"));
+
+        const char* stages[] = { strstr(name_end, "\"frame\":"), strstr(name_end, "\"update\":") };
+        StageStats* targets[] = { &stats.frame, &stats.update };
+
+        for (int i = 0; i < 2; ++i)
+        {
+            if (stages[i])
+            {
+                targets[i]->mean = find_number(stages[i], "mean_us");
+                targets[i]->p50 = find_number(stages[i], "p50_us");
+                targets[i]->p95 = find_number(stages[i], "p95_us");
+                targets[i]->p99 = find_number(stages[i], "p99_us");
+                targets[i]->max = find_number(stages[i], "max_us");
+            }
+        }
+
+        scenes.push_back(stats);
+    }
+
+    return true;
+}
+
+// Print how each compared value moved and return the number that grew by more than threshold (0.1 for 10%). A value that is
+// zero on either side means a broken run or baseline rather than a fast one, and is counted in errors.
+static int compare(const SceneStats& current, const SceneStats& baseline, double threshold, int& errors)
+{
+    if (current.frames != baseline.frames)
+    {
+        printf("  ERROR: %llu frames against %llu in the baseline\n", (unsigned long long)current.frames, (unsigned long long)baseline.frames);
+        ++errors;
+    }
+
+    struct Metric
+    {
+        const char* name;
+        double current;
+        double baseline;
+    };
+
+    // Max and p99 hang on a handful of frames, too few to tell a regression from noise
+    const Metric metrics[] = {
+        { "frame mean", current.frame.mean, baseline.frame.mean },   { "frame p50", current.frame.p50, baseline.frame.p50 },
+        { "frame p95", current.frame.p95, baseline.frame.p95 },      { "update mean", current.update.mean, baseline.update.mean },
+        { "update p95", current.update.p95, baseline.update.p95 },
+    };
+
+    int regressions = 0;
+
+    for (const Metric& metric : metrics)
+    {
+        if (metric.baseline <= 0.0 || metric.current <= 0.0)
+        {
+            printf("  %-12s %10.2f us %10.2f us  ERROR: missing value\n", metric.name, metric.baseline, metric.current);
+            ++errors;
+            continue;
+        }
+
+        double change = metric.current / metric.baseline - 1.0;
+        bool regressed = change > threshold;
+        regressions += regressed;
+        printf("  %-12s %10.2f us %10.2f us %+7.1f%%%s\n", metric.name, metric.baseline, metric.current, change * 100.0,
+               regressed ? "  REGRESSION" : (change < -threshold ? "  improved" : ""));
+    }
+
+    return regressions;
+}
+
+// Parse the whole of text as a number no less than min_value
+static bool parse_int(const char* text, int min_value, int& value)
+{
+    char* end;
+    long parsed = strtol(text, &end, 10);
+
+    if (end == text || *end != '\0' || parsed < min_value || parsed > INT_MAX)
+    {
+        return false;
+    }
+
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+static bool parse_double(const char* text, double min_value, double& value)
+{
+    char* end;
+    double parsed = strtod(text, &end);
+
+    if (end == text || *end != '\0' || !(parsed >= min_value) || !std::isfinite(parsed))
+    {
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
+
+static void usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [options] [scene...]\n"
+            "  --frames N        frames to run each scene for, at least 1 (default 600)\n"
+            "  --workers N       job system worker threads, 0 or more (default one less than the hardware threads)\n"
+            "  --runs N          run each scene N times and keep the fastest, at least 1 (default 1)\n"
+            "  --out PATH        write the results as JSON to PATH (default vgfw_bench.json)\n"
+            "  --baseline PATH   compare against results written by an earlier run\n"
+            "  --threshold F     fractional slowdown counted as a regression, 0 or more (default 0.1)\n"
+            "scenes: test, 3d, fps (default all)\n",
+            program);
+}
+
+int main(int argc, char** argv)
+{
+    VgfwBenchScene settings;
+    const char* out_path = "vgfw_bench.json";
+    const char* baseline_path = nullptr;
+    double threshold = 0.1;
+    int runs = 1;
+    std::vector<const SceneEntry*> selected;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool valid = true;
+
+        if (arg == "--frames" && has_value)
+        {
+            valid = parse_int(argv[++i], 1, settings.frame_count);
+        }
+        else if (arg == "--workers" && has_value)
+        {
+            valid = parse_int(argv[++i], 0, settings.worker_count);
+        }
+        else if (arg == "--runs" && has_value)
+        {
+            valid = parse_int(argv[++i], 1, runs);
+        }
+        else if (arg == "--out" && has_value)
+        {
+            out_path = argv[++i];
+        }
+        else if (arg == "--baseline" && has_value)
+        {
+            baseline_path = argv[++i];
+        }
+        else if (arg == "--threshold" && has_value)
+        {
+            valid = parse_double(argv[++i], 0.0, threshold);
+        }
+        else
+        {
+            const SceneEntry* entry = nullptr;
+
+            for (const SceneEntry& candidate : scene_entries)
+            {
+                if (arg == candidate.name)
+                {
+                    entry = &candidate;
+                }
+            }
+
+            if (!entry)
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            selected.push_back(entry);
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "%s: bad value for %s\n", argv[i], arg.c_str());
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (selected.empty())
+    {
+        for (const SceneEntry& entry : scene_entries)
+        {
+            selected.push_back(&entry);
+        }
+    }
+
+    std::vector<SceneStats> results;
+
+    for (const SceneEntry* entry : selected)
+    {
+        SceneStats stats;
+
+        // Interference from the rest of the machine only ever adds time, so the fastest run is the least noisy
+        for (int run = 0; run < runs; ++run)
+        {
+            VgfwFrameTimer timer;
+
+            if (!entry->run(settings, timer))
+            {
+                fprintf(stderr, "%s: stopped before running all its frames, check it is run from the directory holding the demo assets\n",
+                        entry->name);
+                return EXIT_FAILURE;
+            }
+
+            StageStats frame = stage_stats(timer, VgfwStage::Frame);
+
+            if (run == 0 || frame.mean < stats.frame.mean)
+            {
+                stats.name = entry->name;
+                stats.frames = timer.count(VgfwStage::Update);
+                stats.frame = frame;
+                stats.update = stage_stats(timer, VgfwStage::Update);
+            }
+        }
+
+        results.push_back(stats);
+
+        printf("%-6s %llu frames, frame mean %.2f us p95 %.2f us, update mean %.2f us p95 %.2f us\n", entry->name,
+               (unsigned long long)stats.frames, stats.frame.mean, stats.frame.p95, stats.update.mean, stats.update.p95);
+    }
+
+    if (!write_json(out_path, results))
+    {
+        fprintf(stderr, "%s: could not write results\n", out_path);
+        return EXIT_FAILURE;
+    }
+
+    if (!baseline_path)
+    {
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<SceneStats> baseline;
+
+    if (!read_json(baseline_path, baseline))
+    {
+        fprintf(stderr, "%s: could not read baseline\n", baseline_path);
+        return EXIT_FAILURE;
+    }
+
+    int regressions = 0;
+    int errors = 0;
+
+    for (const SceneStats& current : results)
+    {
+        const SceneStats* previous = nullptr;
+
+        for (const SceneStats& candidate : baseline)
+        {
+            if (candidate.name == current.name)
+            {
+                previous = &candidate;
+            }
+        }
+
+        if (!previous)
+        {
+            printf("%s: ERROR: not in the baseline\n", current.name.c_str());
+            ++errors;
+            continue;
+        }
+
+        printf("%s against baseline (threshold %.0f%%)\n", current.name.c_str(), threshold * 100.0);
+        regressions += compare(current, *previous, threshold, errors);
+    }
+
+    // Scenes left out on the command line are expected to be missing from this run, so these are only noted
+    for (const SceneStats& previous : baseline)
+    {
+        bool run = false;
+
+        for (const SceneStats& current : results)
+        {
+            run |= current.name == previous.name;
+        }
+
+        if (!run)
+        {
+            printf("%s: in the baseline but not run\n", previous.name.c_str());
+        }
+    }
+
+    printf("%d regression%s, %d error%s\n", regressions, regressions == 1 ? "" : "s", errors, errors == 1 ? "" : "s");
+    return regressions || errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
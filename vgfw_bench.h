@@ -0,0 +1,72 @@
+#pragma once
+
+#include "vgfw.h"
+
+// Headless benchmark runs for vgfw_bench. Each demo built with VGFW_NO_MAIN defines a bench_* entry point on top of these.
+
+#if !VGFW_PLATFORM_HEADLESS
+#error vgfw_bench runs the demos headless, define VGFW_HEADLESS
+#endif
+
+// A headless benchmark run of an app: width x height for frame_count frames of fixed_delta seconds each, with keys pressed and
+// released on given frames standing in for a player
+struct VgfwBenchScene
+{
+    struct Key
+    {
+        int frame;
+        int key;
+        bool down;
+    };
+
+    int width = 320;
+    int height = 240;
+    int frame_count = 600;
+    float fixed_delta = 1.0f / 60.0f;
+    int worker_count = -1;
+    std::vector<Key> keys;
+
+    // Press key on frame and release it on the next one
+    void press(int frame, int key) { hold(frame, frame + 1, key); }
+
+    // Hold key down from frame first until frame last
+    void hold(int first, int last, int key)
+    {
+        keys.push_back({ first, key, true });
+        keys.push_back({ last, key, false });
+    }
+};
+
+// Run a new App through scene and copy out its frame timings. Fails unless every frame of the scene was run.
+template <typename App>
+bool vgfw_run_bench(const wchar_t* name, const VgfwBenchScene& scene, VgfwFrameTimer& timer)
+{
+    App app;
+    app.set_worker_count(scene.worker_count);
+
+    if (!app.initialize(name, scene.width, scene.height, 1))
+    {
+        return false;
+    }
+
+    App* target = &app;
+    typename App::HeadlessOptions options;
+    options.frame_count = scene.frame_count;
+    options.fixed_delta = scene.fixed_delta;
+    options.on_input = [&scene, target](int frame) {
+        for (const VgfwBenchScene::Key& key : scene.keys)
+        {
+            if (key.frame == frame)
+            {
+                target->queue_key_event(key.key, key.down);
+            }
+        }
+    };
+
+    app.set_headless_options(options);
+    app.run();
+    timer = app.frame_timer();
+
+    // run() returns early if on_create() fails, say when the app can't find its assets, or once on_update() asks to quit
+    return timer.count(VgfwStage::Update) >= static_cast<uint64_t>(scene.frame_count);
+}
@@ -0,0 +1,335 @@
+#include "vgfw.h"
+
+#include <climits>
+
+// Checks parts of vgfw.h that can go wrong without anything showing on screen. Prints each failed check and exits with a
+// failure if there were any.
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                                                                             \
+    do                                                                                                                                               \
+    {                                                                                                                                                \
+        if (!(condition))                                                                                                                            \
+        {                                                                                                                                            \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);                                                            \
+            ++failures;                                                                                                                              \
+        }                                                                                                                                            \
+    } while (0)
+
+//===================================================================================================================================================
+//
+// Overlay
+//
+//===================================================================================================================================================
+// Has draw put an overlay at (x, y) into a dst_width x dst_height surface that sits inside a guard band of untouched pixels, and
+// checks every pixel of the whole buffer against the overlay's own unclipped image
+template <typename T, typename Draw>
+static void check_overlay_draw(const VgfwOverlay& overlay, const std::vector<T>& image, int x, int y, Draw draw)
+{
+    const int dst_width = 40;
+    const int dst_height = 30;
+    const int guard = 16;
+    const int pitch = dst_width + guard * 2;
+    const T fill = static_cast<T>(0xa5);
+    std::vector<T> buffer(pitch * (dst_height + guard * 2), fill);
+    T* dst = &buffer[guard * pitch + guard];
+
+    draw(dst, pitch, dst_width, dst_height, x, y);
+
+    int mismatches = 0;
+
+    for (int row = -guard; row < dst_height + guard; ++row)
+    {
+        for (int column = -guard; column < dst_width + guard; ++column)
+        {
+            int64_t u = static_cast<int64_t>(column) - x;
+            int64_t v = static_cast<int64_t>(row) - y;
+            bool inside = column >= 0 && column < dst_width && row >= 0 && row < dst_height;
+            bool covered = inside && u >= 0 && u < overlay.width() && v >= 0 && v < overlay.height();
+            T expected = covered ? image[v * overlay.width() + u] : fill;
+            mismatches += dst[row * pitch + column] != expected;
+        }
+    }
+
+    if (mismatches)
+    {
+        fprintf(stderr, "overlay drawn at (%d, %d): %d pixels wrong\n", x, y, mismatches);
+    }
+
+    CHECK(mismatches == 0);
+}
+
+static void test_overlay_clipping()
+{
+    VgfwOverlay overlay;
+    overlay.set_colors(15, 1);
+    overlay.set_line(0, "FRAME 16.67");
+    overlay.set_line(1, "UPDATE 2.50");
+    int w = overlay.width();
+    int h = overlay.height();
+
+    // The unclipped image, drawn into a surface exactly its size
+    std::vector<uint8_t> image(w * h);
+    overlay.draw(image.data(), w, w, h, 0, 0);
+
+    uint32_t colors[256];
+    std::vector<uint32_t> image32(w * h);
+
+    for (int i = 0; i < 256; ++i)
+    {
+        colors[i] = 0xff000000u | (i * 0x010101u);
+    }
+
+    for (int i = 0; i < w * h; ++i)
+    {
+        image32[i] = colors[image[i]];
+    }
+
+    // Inside, partly off each edge, just off each edge and far off, out to the limits of int
+    const int positions[][2] = {
+        { 0, 0 },       { 2, 2 },       { -3, 5 },      { 5, -3 },      { 30, 25 },     { -w + 1, -h + 1 }, { 39, 29 },
+        { 40, 0 },      { 0, 30 },      { 40, 30 },     { 100, 100 },   { -w, 0 },      { 0, -h },          { -w - 7, -h - 7 },
+        { INT_MIN, 0 }, { 0, INT_MIN }, { INT_MAX, 0 }, { 0, INT_MAX }, { INT_MIN, INT_MIN }, { INT_MAX, INT_MAX },
+    };
+
+    auto draw8 = [&overlay](uint8_t* dst, int pitch, int width, int height, int x, int y) { overlay.draw(dst, pitch, width, height, x, y); };
+    auto draw32 = [&overlay, &colors](uint32_t* dst, int pitch, int width, int height, int x, int y) {
+        overlay.draw(dst, pitch, width, height, x, y, colors);
+    };
+
+    for (const int* position : positions)
+    {
+        check_overlay_draw(overlay, image, position[0], position[1], draw8);
+        check_overlay_draw(overlay, image32, position[0], position[1], draw32);
+    }
+}
+
+//===================================================================================================================================================
+//
+// Sprites
+//
+//===================================================================================================================================================
+// Runs hold 16-bit positions and lengths, so images up to max_width pixels wide must draw whole and wider ones must be refused
+static void test_sprite_width_limit()
+{
+    const int width = VgfwSprite::max_width;
+    std::vector<uint8_t> pixels(width + 1);
+
+    for (int i = 0; i <= width; ++i)
+    {
+        pixels[i] = static_cast<uint8_t>(1 + i % 255);
+    }
+
+    VgfwSprite sprite;
+    CHECK(sprite.from_indexed(pixels.data(), width, 1, width, 0));
+    CHECK(sprite.width() == width && sprite.opaque_count() == static_cast<size_t>(width));
+
+    std::vector<uint8_t> frame(width, 0);
+    VgfwView view;
+    view.pixels = frame.data();
+    view.width = width;
+    view.height = 1;
+    view.pitch = width;
+    sprite.draw(view, 0, 0);
+    CHECK(memcmp(frame.data(), pixels.data(), width) == 0);
+
+    CHECK(!sprite.from_indexed(pixels.data(), width + 1, 1, width + 1, 0));
+    CHECK(sprite.width() == 0 && sprite.height() == 0 && sprite.opaque_count() == 0);
+    sprite.draw(view, 0, 0);
+}
+
+//===================================================================================================================================================
+//
+// Input log
+//
+//===================================================================================================================================================
+// Frames with no events, a few, and more than a count byte could hold must all read back as written
+static void test_input_log_round_trip()
+{
+    const char* path = "vgfw_test_input.log";
+    const size_t counts[] = { 0, 3, 255, 256, 1000 };
+    std::vector<std::vector<VgfwInputEvent>> frames;
+
+    for (size_t count : counts)
+    {
+        std::vector<VgfwInputEvent> events(count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            events[i].timestamp = 0;
+            events[i].key = static_cast<uint8_t>(i * 7);
+            events[i].down = (i & 1) != 0;
+        }
+
+        frames.push_back(events);
+    }
+
+    VgfwInputLog log;
+    CHECK(log.open_write(path));
+
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        log.write_frame(0.25f * i, frames[i]);
+    }
+
+    log.close();
+    CHECK(log.open_read(path));
+
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        float delta = 0.0f;
+        std::vector<VgfwInputEvent> events;
+        CHECK(log.read_frame(delta, events));
+        CHECK(delta == 0.25f * i);
+        CHECK(events.size() == frames[i].size());
+
+        for (size_t j = 0; j < events.size() && j < frames[i].size(); ++j)
+        {
+            CHECK(events[j].key == frames[i][j].key && events[j].down == frames[i][j].down);
+        }
+    }
+
+    float delta;
+    std::vector<VgfwInputEvent> events;
+    CHECK(!log.read_frame(delta, events));
+    log.close();
+    remove(path);
+}
+
+//===================================================================================================================================================
+//
+// Frame capture
+//
+//===================================================================================================================================================
+static std::vector<uint8_t> read_file(const char* path)
+{
+    std::vector<uint8_t> bytes;
+    FILE* file = fopen(path, "rb");
+
+    if (file)
+    {
+        int byte;
+
+        while ((byte = fgetc(file)) != EOF)
+        {
+            bytes.push_back(static_cast<uint8_t>(byte));
+        }
+
+        fclose(file);
+    }
+
+    return bytes;
+}
+
+static void write_file(const char* path, const uint8_t* bytes, size_t size)
+{
+    FILE* file = fopen(path, "wb");
+
+    if (file)
+    {
+        fwrite(bytes, 1, size, file);
+        fclose(file);
+    }
+}
+
+// Reads the capture at path to its end, returning the number of frames read and whether it stopped on a damaged record
+static int read_capture(const char* path, bool& failed)
+{
+    VgfwCaptureReader reader;
+    int frames = 0;
+    failed = false;
+
+    if (!reader.open(path))
+    {
+        return -1;
+    }
+
+    while (reader.read_frame())
+    {
+        ++frames;
+    }
+
+    failed = reader.failed();
+    return frames;
+}
+
+// A whole capture reads to a clean end, one cut off part way through a record or its size reads as damaged, and one cut off
+// between records reads as a shorter capture
+static void test_capture_damage()
+{
+    const char* path = "vgfw_test_capture.vcap";
+    const char* damaged_path = "vgfw_test_damaged.vcap";
+    const int width = 16;
+    const int height = 8;
+    const int frame_count = 3;
+    uint8_t pixels[width * height];
+    uint32_t palette[256] = {};
+
+    VgfwCaptureWriter writer;
+    CHECK(writer.open(path, width, height));
+
+    for (int frame = 0; frame < frame_count; ++frame)
+    {
+        for (int i = 0; i < width * height; ++i)
+        {
+            pixels[i] = static_cast<uint8_t>(i * (frame + 1));
+        }
+
+        palette[frame] = 0xff102030u * (frame + 1);
+        writer.submit(frame, pixels, width, palette);
+    }
+
+    writer.close();
+
+    bool failed;
+    CHECK(read_capture(path, failed) == frame_count);
+    CHECK(!failed);
+
+    std::vector<uint8_t> bytes = read_file(path);
+    uint32_t first_size;
+    CHECK(bytes.size() > 20);
+    memcpy(&first_size, &bytes[16], sizeof(first_size));
+    size_t first_end = 20 + first_size;
+
+    // Cut at the end of the first record, two bytes into the second's size, and one byte short of the end
+    write_file(damaged_path, bytes.data(), first_end);
+    CHECK(read_capture(damaged_path, failed) == 1);
+    CHECK(!failed);
+
+    write_file(damaged_path, bytes.data(), first_end + 2);
+    CHECK(read_capture(damaged_path, failed) == 1);
+    CHECK(failed);
+
+    write_file(damaged_path, bytes.data(), bytes.size() - 1);
+    CHECK(read_capture(damaged_path, failed) == frame_count - 1);
+    CHECK(failed);
+
+    // A record whose pixel packet runs past the end of the frame
+    std::vector<uint8_t> bad(bytes.begin(), bytes.begin() + 16);
+    const uint8_t record[] = { 6, 0, 0, 0, 0, 0, 0, 0xff, 0x7f, 0 };
+    bad.insert(bad.end(), record, record + sizeof(record));
+    write_file(damaged_path, bad.data(), bad.size());
+    CHECK(read_capture(damaged_path, failed) == 0);
+    CHECK(failed);
+
+    remove(path);
+    remove(damaged_path);
+}
+
+int main()
+{
+    test_overlay_clipping();
+    test_sprite_width_limit();
+    test_input_log_round_trip();
+    test_capture_damage();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check%s failed\n", failures, failures == 1 ? "" : "s");
+        return EXIT_FAILURE;
+    }
+
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}